@@ -0,0 +1,61 @@
+#version 150
+
+uniform mat4	ciModelViewProjection;
+uniform mat3	ciNormalMatrix;
+// Progress along the curves, before easing.
+uniform float	uCurveT;
+// The far and near z planes, for fading with distance.
+uniform vec2	uRangeZ;
+// Whether to use the curve colors. Otherwise everything is white.
+uniform bool	uColored;
+// Particles are grown to at least uMinPixels across, fading to keep the
+// same coverage, so they don't drop out of a scaled down buffer.
+uniform mat4	ciProjectionMatrix;
+uniform float	uParticleSize;
+uniform float	uViewportHeight;
+uniform float	uMinPixels;
+
+in vec4		ciPosition;
+in vec2		ciTexCoord0;
+in vec3		ciNormal;
+in vec4		ciColor;
+// Per-instance curve. The start alpha is in P0's w, the end alpha in P1's.
+in vec4		aP0;
+in vec4		aP1;
+in vec3		aP2;
+in vec3		aP3;
+// Start and end colors, RGBA8 with red in the low byte.
+in ivec2	aColors;
+out highp vec2	TexCoord;
+out lowp vec4	Color;
+out highp vec3	Normal;
+
+vec3 unpackColor( int c )
+{
+	return vec3(float(c & 0xff), float((c >> 8) & 0xff), float((c >> 16) & 0xff)) / 255.0;
+}
+
+void main( void )
+{
+	// Ease in and out, the same as ParticleSim.
+	float			t = (3.0 - 2.0 * uCurveT) * uCurveT * uCurveT;
+	float			u = 1.0 - t;
+	vec3			inst_pos = u*u*u * aP0.xyz + 3.0*u*u*t * aP1.xyz + 3.0*u*t*t * aP2 + t*t*t * aP3;
+
+	// Blur out a little based on distance
+	float			fade = (inst_pos.z - uRangeZ.x) * 0.9 / (uRangeZ.y - uRangeZ.x) + 0.1;
+	float			alpha = mix(aP0.w, aP1.w, t) * fade;
+	vec3			clr = vec3(1);
+	if (uColored) clr = mix(unpackColor(aColors.x), unpackColor(aColors.y), t);
+
+	// Pixels across at this depth, and how much to grow.
+	vec4			center = ciModelViewProjection * vec4( inst_pos, 1 );
+	float			pixels = uParticleSize * ciProjectionMatrix[1][1] * 0.5 * uViewportHeight / max(center.w, 0.0001);
+	float			grow = max(1.0, uMinPixels / max(pixels, 0.0001));
+	alpha /= grow * grow;
+
+	gl_Position	= ciModelViewProjection * vec4( ciPosition.xyz * grow + inst_pos, 1 );
+	Color 		= ciColor * vec4(clr, alpha);
+	TexCoord	= ciTexCoord0;
+	Normal		= ciNormalMatrix * ciNormal;
+}
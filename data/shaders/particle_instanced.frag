@@ -17,9 +17,6 @@ void main( void )
 
 	oColor = texture( uTex0, TexCoord.st ) * Color;
 //	oColor = texture( uTex0, TexCoord.st );
-oColor[0] = 1;
-oColor[1] = 1;
-oColor[2] = 1;
 
 //	oColor = Color;
 }
\ No newline at end of file
@@ -2,36 +2,61 @@
 
 uniform mat4	ciModelViewProjection;
 uniform mat3	ciNormalMatrix;
+// The world bounds the instances were quantized to.
+uniform vec3	uNearLL;
+uniform vec3	uNearUR;
+uniform vec3	uFarLL;
+uniform vec3	uFarUR;
+// Whether vColor is bound. Otherwise everything is white.
+uniform bool	uColored;
+// Particles are grown to at least uMinPixels across, fading to keep the
+// same coverage, so they don't drop out of a scaled down buffer.
+uniform mat4	ciProjectionMatrix;
+uniform float	uParticleSize;
+uniform float	uViewportHeight;
+uniform float	uMinPixels;
 
 in vec4		ciPosition;
 in vec2		ciTexCoord0;
 in vec3		ciNormal;
 in vec4		ciColor;
-//in vec3		vInstancePosition; // per-instance position variable
-in vec4		vInstancePosition; // per-instance position variable
+// Per-instance: unorm16 x and y in the first int, unorm16 z, unorm8 alpha
+// and size in the second. Positions are units of the world bounds' frustum.
+// Size is in particles, for cluster impostors; 0 is one particle.
+in ivec2	vInstance;
+// Per-instance: RGBA8, red in the low byte. Its alpha is unused.
+in int		vColor;
 out highp vec2	TexCoord;
 out lowp vec4	Color;
 out highp vec3	Normal;
 
 void main( void )
 {
-	// The per-instance data consists of x,y,z in the first 3 floats
-	// and RGB (8 bits each) in the 4th float. I did it this way partially because
-	// of performance -- I have no idea if the time added to decode is worth
-	// the memory saved transporting the full 32 bit color components, but I'd
-	// guess so -- but mostly because I don't know how to get custom per-instance
-	// data of anything larger than a vec4.
-	vec3			inst_pos = vec3(vInstancePosition[0], vInstancePosition[1], vInstancePosition[2]);
-//	int				e_clr = int(vInstancePosition[3]);
-//	vec3			inst_clr = vec3(float((e_clr>>16)&0xff) / 255.0,
-//									float((e_clr>>8)&0xff) / 255.0,
-//									float(e_clr&0xff) / 255.0);
+	// z picks a slice between the far and near planes, and x and y are a
+	// position across that slice.
+	vec3			u = vec3(	float(vInstance.x & 0xffff),
+								float((vInstance.x >> 16) & 0xffff),
+								float(vInstance.y & 0xffff)) / 65535.0;
+	float			alpha = float((vInstance.y >> 16) & 0xff) / 255.0;
+	float			size = max(1.0, float((vInstance.y >> 24) & 0xff));
+	vec3			lo = mix(uFarLL, uNearLL, u.z),
+					hi = mix(uFarUR, uNearUR, u.z);
+	vec3			inst_pos = vec3(mix(lo.xy, hi.xy, u.xy), lo.z);
+	vec3			inst_clr = vec3(1);
+	if (uColored) {
+		inst_clr = vec3(	float(vColor & 0xff),
+							float((vColor >> 8) & 0xff),
+							float((vColor >> 16) & 0xff)) / 255.0;
+	}
 
-	gl_Position	= ciModelViewProjection * ( ciPosition + vec4( inst_pos, 0 ) );
-//	Color 		= ciColor * vec4(inst_clr, 1);
-//	Color 		= vec4(1, 1, 1, 1);
-//	Color 		= ciColor;
-	Color 		= ciColor * vec4(1, 1, 1, vInstancePosition[3]);
+	// Pixels across at this depth, and how much to grow.
+	vec4			center = ciModelViewProjection * vec4( inst_pos, 1 );
+	float			pixels = uParticleSize * size * ciProjectionMatrix[1][1] * 0.5 * uViewportHeight / max(center.w, 0.0001);
+	float			grow = max(1.0, uMinPixels / max(pixels, 0.0001));
+	alpha /= grow * grow;
+
+	gl_Position	= ciModelViewProjection * vec4( ciPosition.xyz * (size * grow) + inst_pos, 1 );
+	Color 		= ciColor * vec4(inst_clr, alpha);
 	TexCoord	= ciTexCoord0;
 	Normal		= ciNormalMatrix * ciNormal;
 }
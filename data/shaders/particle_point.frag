@@ -0,0 +1,12 @@
+#version 150
+
+in vec4	Color;
+
+out vec4 			oColor;
+
+void main( void )
+{
+	// The same linear falloff as the jot texture, without sampling it.
+	float d = length( gl_PointCoord - vec2( 0.5 ) ) * 2.0;
+	oColor = Color * vec4( 1, 1, 1, max( 1.0 - d, 0.0 ) );
+}
@@ -0,0 +1,45 @@
+#version 150
+
+uniform mat4	ciModelViewProjection;
+uniform mat4	ciProjectionMatrix;
+// The world bounds the instances were quantized to.
+uniform vec3	uNearLL;
+uniform vec3	uNearUR;
+uniform vec3	uFarLL;
+uniform vec3	uFarUR;
+// Whether vColor is bound. Otherwise everything is white.
+uniform bool	uColored;
+// Points are uParticleSize across in the world, times the instance's size,
+// and grown to at least uMinPixels, fading to keep the same coverage.
+uniform float	uParticleSize;
+uniform float	uViewportHeight;
+uniform float	uMinPixels;
+
+// One vertex per instance, packed the same as particle_instanced.vert.
+in ivec2	vInstance;
+in int		vColor;
+out lowp vec4	Color;
+
+void main( void )
+{
+	vec3			u = vec3(	float(vInstance.x & 0xffff),
+								float((vInstance.x >> 16) & 0xffff),
+								float(vInstance.y & 0xffff)) / 65535.0;
+	float			alpha = float((vInstance.y >> 16) & 0xff) / 255.0;
+	float			size = max(1.0, float((vInstance.y >> 24) & 0xff));
+	vec3			lo = mix(uFarLL, uNearLL, u.z),
+					hi = mix(uFarUR, uNearUR, u.z);
+	vec3			inst_pos = vec3(mix(lo.xy, hi.xy, u.xy), lo.z);
+	vec3			inst_clr = vec3(1);
+	if (uColored) {
+		inst_clr = vec3(	float(vColor & 0xff),
+							float((vColor >> 8) & 0xff),
+							float((vColor >> 16) & 0xff)) / 255.0;
+	}
+
+	gl_Position		= ciModelViewProjection * vec4( inst_pos, 1 );
+	float			pixels = uParticleSize * size * ciProjectionMatrix[1][1] * 0.5 * uViewportHeight / max(gl_Position.w, 0.0001);
+	float			grow = max(1.0, uMinPixels / max(pixels, 0.0001));
+	gl_PointSize	= pixels * grow;
+	Color			= vec4(inst_clr, alpha / (grow * grow));
+}
@@ -2,14 +2,60 @@
 
 out vec4 oColor;
 uniform sampler2D uTex0;
+// Whether the particles have colors. Otherwise they draw black.
+uniform bool uColored;
+// How to scale up a particle buffer smaller than the screen. 0 is the
+// texture's bilinear filter, 1 is Catmull-Rom, which keeps edges sharper.
+uniform int uUpscale;
 in vec2	TexCoord;
 
+// Catmull-Rom weights for the four texels around a sample, f along the way
+// from the second to the third.
+vec4 catmullRom( float f )
+{
+	float f2 = f * f;
+	float f3 = f2 * f;
+	return vec4(	-0.5 * f3 + f2 - 0.5 * f,
+					1.5 * f3 - 2.5 * f2 + 1.0,
+					-1.5 * f3 + 2.0 * f2 + 0.5 * f,
+					0.5 * f3 - 0.5 * f2 );
+}
+
+vec4 sampleBicubic( vec2 tc )
+{
+	ivec2 size = textureSize( uTex0, 0 );
+	vec2 p = tc * vec2( size ) - 0.5;
+	vec2 i = floor( p );
+	vec4 wx = catmullRom( p.x - i.x );
+	vec4 wy = catmullRom( p.y - i.y );
+	vec4 sum = vec4( 0 );
+	for (int y = 0; y < 4; ++y) {
+		vec4 row = vec4( 0 );
+		for (int x = 0; x < 4; ++x) {
+			ivec2 t = clamp( ivec2( i ) + ivec2( x - 1, y - 1 ), ivec2( 0 ), size - 1 );
+			row += texelFetch( uTex0, t, 0 ) * wx[x];
+		}
+		sum += row * wy[y];
+	}
+	// The lobes can ring below zero.
+	return max( sum, vec4( 0 ) );
+}
+
 void main( void )
 {
-	oColor = vec4( 1 ) * texture( uTex0, TexCoord.st );
-	oColor[0] = 0;
-	oColor[1] = 0;
-	oColor[2] = 0;
+	if (uUpscale == 1) {
+		oColor = sampleBicubic( TexCoord.st );
+	} else {
+		oColor = vec4( 1 ) * texture( uTex0, TexCoord.st );
+	}
+	if (uColored) {
+		// Alpha is coverage, so this undoes the blend.
+		oColor.rgb = clamp(oColor.rgb / max(oColor[3], 0.0001), 0.0, 1.0);
+	} else {
+		oColor[0] = 0;
+		oColor[1] = 0;
+		oColor[2] = 0;
+	}
 
 	// Saturate the alpha
 	float max = 0.33;
@@ -3,22 +3,24 @@
 #include <cinder/gl/draw.h>
 #include <cinder/gl/gl.h>
 #include <cinder/gl/scoped.h>
+#include "kt/async/task.h"
+#include "kt/async/thread_pool.h"
 #include "kt/math/geometry.h"
 #include "noise.h"
 #include "settings.h"
 
 namespace cs {
 
+namespace {
+// Run on the pool.
+ci::Surface8u	generate_image(const glm::ivec2 &window_size, const ci::Color&);
+}
+
 /**
  * @class cs::Background
  */
 Background::Background(const cs::Settings &s, const glm::ivec2 &window_size)
-		: mSettings(s)
-		, mWorkerWindowSize(window_size)
-		, mWorkerColor(s.mBackgroundColor) {
-	// Setup
-	mHasWorkerSurface = false;
-
+		: mSettings(s) {
 	// Create the mesh
 	const glm::vec2			tc_ul(0.0f, 0.0f),
 							tc_ur(1.0f, 0.0f),
@@ -37,32 +39,22 @@ Background::Background(const cs::Settings &s, const glm::ivec2 &window_size)
 	mBatch = ci::gl::Batch::create(mesh, shader);
 	if (!mBatch) throw std::runtime_error("Background vbo can't create batch");
 
-	// Generate background
-	mThread = std::thread([this](){generateImage();});
-}
-
-Background::~Background() {
-	try {
-		mThread.join();
-	} catch (std::exception const&) {
-	}
+	// Generate background. The pool does the work, draw() uploads it.
+	const ci::Color			color(s.mBackgroundColor);
+	mImage = kt::async::run(kt::async::PoolExecutor::shared(), [window_size, color]() {
+		return generate_image(window_size, color);
+	});
 }
 
-void Background::update() {
-	if (mHasWorkerSurface) {
-		mHasWorkerSurface = false;
-
-		if (mWorkerSurface.getWidth() > 0 && mWorkerSurface.getHeight() > 0) {
-			if (mTexture && mWorkerSurface.getWidth() == mTexture->getWidth() && mWorkerSurface.getHeight() == mTexture->getHeight()) {
-				mTexture->update(mWorkerSurface);
-			} else {
-				mTexture = ci::gl::Texture2d::create(mWorkerSurface);
-			}
+void Background::draw() {
+	if (mImage.ready()) {
+		try {
+			setSurface(mImage.get());
+		} catch (std::exception const&) {
 		}
+		mImage = kt::async::Task<ci::Surface8u>();
 	}
-}
 
-void Background::draw() {
 	ci::gl::clear(mSettings.mBackgroundColor);
 	if (mTexture) {
 		ci::gl::color(1, 1, 1, 1);
@@ -72,8 +64,21 @@ void Background::draw() {
 	}
 }
 
+void Background::setSurface(const ci::Surface8u &s) {
+	if (s.getWidth() > 0 && s.getHeight() > 0) {
+		if (mTexture && s.getWidth() == mTexture->getWidth() && s.getHeight() == mTexture->getHeight()) {
+			mTexture->update(s);
+		} else {
+			mTexture = ci::gl::Texture2d::create(s);
+		}
+	}
+}
+
 namespace {
 
+// Rows per chunk when generating in parallel.
+const size_t	ROW_GRAIN = 32;
+
 uint8_t			f_color_to_i(const float v) {
 	int32_t		iv = static_cast<int32_t>(v*255.0f);
 	if (iv <= 0) return 0;
@@ -119,61 +124,64 @@ float			border_value(const float x, const float y, const float w, const float h,
 	return 0.0f;
 }
 
-}
-
-void Background::generateImage() {
-	if (mWorkerWindowSize.x < 1 || mWorkerWindowSize.y < 1) return;
+ci::Surface8u	generate_image(const glm::ivec2 &window_size, const ci::Color &color) {
+	if (window_size.x < 1 || window_size.y < 1) return ci::Surface8u();
 
-	ci::Surface8u		s = ci::Surface8u(mWorkerWindowSize.x, mWorkerWindowSize.y, true);
-	if (s.getWidth() != mWorkerWindowSize.x || s.getHeight() != mWorkerWindowSize.y) return;
+	ci::Surface8u		s = ci::Surface8u(window_size.x, window_size.y, true);
+	if (s.getWidth() != window_size.x || s.getHeight() != window_size.y) return ci::Surface8u();
 
 	Noise				noise(-1.0f, 1.0f);
 	const float			fw(static_cast<float>(s.getWidth())),
 						fh(static_cast<float>(s.getHeight()));
 	const float			edge_d( ((fw + fh) / 2.0f) * 0.15f);
 	std::vector<float>	frac_t, frac_b, frac_l;
-	frac_t.resize(mWorkerWindowSize.x/16);
-	frac_b.resize(mWorkerWindowSize.x/16);
-	frac_l.resize(mWorkerWindowSize.y);
+	frac_t.resize(window_size.x/16);
+	frac_b.resize(window_size.x/16);
+	frac_l.resize(window_size.y);
 	midpoint_displacement(noise, frac_t);
 	midpoint_displacement(noise, frac_b);
 	midpoint_displacement(noise, frac_l);
 
 	float				saturate = 0.25f;
 
-	auto				pix(s.getIter());
-	while (pix.line()) {
-		while (pix.pixel()) {
-			const glm::vec2		fpt(static_cast<float>(pix.x()), static_cast<float>(pix.y()));
-			const glm::vec2		unit_fpt(fpt.x / fw, fpt.y / fh);
-			const float			warp = kt::math::hermite_at(unit_fpt.y, frac_l) * 0.005f;
-			float				offset = unit_fpt.x + warp;
-			if (offset < 0.0f) offset = 0.0f;
-			else if (offset > 1.0f) offset = 1.0f;
-//			const float			t = kt::math::hermite_at(unit_fpt.x*warp, frac_t),
-//								b = kt::math::hermite_at(unit_fpt.x*warp, frac_b);
-			const float			t = kt::math::hermite_at(offset, frac_t),
-								b = kt::math::hermite_at(offset, frac_b);
-			float				v = glm::mix(t, b, unit_fpt.y);
-			if (v <= 0.0f) {
+	// Rows are independent, so fill bands of them in parallel. The noise
+	// engine isn't shareable, so each band gets its own.
+	const int32_t		width = s.getWidth();
+	kt::async::parallel_for(0, static_cast<size_t>(s.getHeight()), ROW_GRAIN, [&](const size_t row_b, const size_t row_e) {
+		Noise				band_noise(-1.0f, 1.0f);
+		auto				pix(s.getIter(ci::Area(0, static_cast<int32_t>(row_b), width, static_cast<int32_t>(row_e))));
+		while (pix.line()) {
+			while (pix.pixel()) {
+				const glm::vec2		fpt(static_cast<float>(pix.x()), static_cast<float>(pix.y()));
+				const glm::vec2		unit_fpt(fpt.x / fw, fpt.y / fh);
+				const float			warp = kt::math::hermite_at(unit_fpt.y, frac_l) * 0.005f;
+				float				offset = unit_fpt.x + warp;
+				if (offset < 0.0f) offset = 0.0f;
+				else if (offset > 1.0f) offset = 1.0f;
+//				const float			t = kt::math::hermite_at(unit_fpt.x*warp, frac_t),
+//									b = kt::math::hermite_at(unit_fpt.x*warp, frac_b);
+				const float			t = kt::math::hermite_at(offset, frac_t),
+									b = kt::math::hermite_at(offset, frac_b);
+				float				v = glm::mix(t, b, unit_fpt.y);
+				if (v <= 0.0f) {
+					v = 0.0f;
+				} else {
+					v = -(kt::math::s_curvef(v) * saturate);
+				}
+				// This fractal thing looks really lame, let's turn it off
 				v = 0.0f;
-			} else {
-				v = -(kt::math::s_curvef(v) * saturate);
-			}
-			// This fractal thing looks really lame, let's turn it off
-			v = 0.0f;
 
-			// Apply a little per-pixel noise
-			const float			ppn = ((noise.nextFloat() + 1.0f) / 2.0f) * (-0.075f);
+				// Apply a little per-pixel noise
+				const float			ppn = ((band_noise.nextFloat() + 1.0f) / 2.0f) * (-0.075f);
 
-			// Apply a border
-//			const float			bv = kt::math::s_curvef(border_value(fpt.x, fpt.y, fw, fh, edge_d)) * -0.15f;
-			const float			bv = ci::math<float>::pow(border_value(fpt.x, fpt.y, fw, fh, edge_d), 2.5f) * -0.25f;
+				// Apply a border
+//				const float			bv = kt::math::s_curvef(border_value(fpt.x, fpt.y, fw, fh, edge_d)) * -0.15f;
+				const float			bv = ci::math<float>::pow(border_value(fpt.x, fpt.y, fw, fh, edge_d), 2.5f) * -0.25f;
 
-			// Set the colors
-			pix.r() = f_color_to_i(mWorkerColor.r + v + ppn + bv);
-			pix.g() = f_color_to_i(mWorkerColor.g + v + ppn + bv);
-			pix.b() = f_color_to_i(mWorkerColor.b + v + ppn + bv);
+				// Set the colors
+				pix.r() = f_color_to_i(color.r + v + ppn + bv);
+				pix.g() = f_color_to_i(color.g + v + ppn + bv);
+				pix.b() = f_color_to_i(color.b + v + ppn + bv);
 
 #if 0
 v = kt::math::linear_at(unit_fpt.x, frac_t);
@@ -182,12 +190,14 @@ v = (v + 1.0f) / 2.0f;
 uint8_t c = static_cast<uint8_t>(v * 255.0f);
 pix.r() = pix.b() = pix.g() = c;
 #endif
-			pix.a() = 255;
+				pix.a() = 255;
+			}
 		}
-	}
+	});
+
+	return s;
+}
 
-	mWorkerSurface = s;
-	mHasWorkerSurface = true;
 }
 
 } // namespace cs
@@ -1,12 +1,11 @@
 #ifndef CS_BACKGROUND_H_
 #define CS_BACKGROUND_H_
 
-#include <atomic>
-#include <thread>
 #include <cinder/Surface.h>
 #include <cinder/Vector.h>
 #include <cinder/gl/Batch.h>
 #include <cinder/gl/Texture.h>
+#include "kt/async/task.h"
 
 namespace cs {
 class Settings;
@@ -14,31 +13,26 @@ class Settings;
 /**
  * @class cs::Background
  * @brief Draw the background.
- * @description Most of this class is actually devoted to rendering the background image.
+ * @description Most of this class is actually devoted to rendering the background image,
+ * which is generated on the pool and handed to the main thread when it's done.
  */
 class Background {
 public:
 	Background() = delete;
 	Background(const Background&) = delete;
 	Background(const cs::Settings&, const glm::ivec2 &window_size);
-	~Background();
 
-	void					update();
 	void					draw();
 
 private:
-	// Run on worker thread
-	void					generateImage();
+	// Run on the main thread, once the image is generated.
+	void					setSurface(const ci::Surface8u&);
 
 	const cs::Settings&		mSettings;
+	// The image, until it's uploaded.
+	kt::async::Task<ci::Surface8u>	mImage;
 	ci::gl::Texture2dRef	mTexture;
 	ci::gl::BatchRef		mBatch;
-
-	std::thread				mThread;
-	glm::ivec2				mWorkerWindowSize = glm::ivec2(0);
-	ci::Color				mWorkerColor;
-	ci::Surface8u			mWorkerSurface;
-	std::atomic_bool		mHasWorkerSurface;
 };
 
 } // namespace cs
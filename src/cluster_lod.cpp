@@ -0,0 +1,223 @@
+#include "cluster_lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "kt/async/thread_pool.h"
+#include "particle.h"
+
+namespace cs {
+
+namespace {
+const float			UNORM16 = 65535.0f;
+
+// Answer how many cells span takes, at least 1. Left as a double, since
+// tiny cells can make more than fit in an int.
+double				cells_for(const float span, const float cell) {
+	if (!(cell > 0.0f)) return 1.0;
+	const double	n = std::ceil(static_cast<double>(std::fabs(span)) / cell);
+	return (n > 1.0 ? n : 1.0);
+}
+
+inline uint32_t		cell_of(const uint16_t u, const uint32_t cells) {
+	return static_cast<uint32_t>((static_cast<uint64_t>(u) * cells) >> 16);
+}
+
+inline uint8_t		to_unorm8(const float v) {
+	return static_cast<uint8_t>(std::min(255.0f, v + 0.5f));
+}
+}
+
+/**
+ * @class cs::ClusterLod
+ */
+ClusterLod::ClusterLod() {
+}
+
+void ClusterLod::begin(	const InstancePacker &packer, const float particle_size,
+						const float depth, const size_t instances, const size_t chunks) {
+	const kt::math::Cube&	b(packer.getBounds());
+	const float				far_x = b.mFarUR.x - b.mFarLL.x,
+							far_y = b.mFarUR.y - b.mFarLL.y,
+							slope_x = (b.mNearUR.x - b.mNearLL.x) - far_x,
+							slope_y = (b.mNearUR.y - b.mNearLL.y) - far_y,
+							depth_world = std::fabs(b.mNearLL.z - b.mFarLL.z);
+	mDepth = (particle_size > 0.0f ? std::min(std::max(depth, 0.0f), 1.0f) : 0.0f);
+
+	// Each band's extent. The slice is widest at the back of the band.
+	float					span_x[BANDS],
+							span_y[BANDS],
+							span_z[BANDS];
+	for (size_t k=0; k<BANDS; ++k) {
+		Band&				band(mBands[k]);
+		band.mLo = mDepth * static_cast<float>(k) / static_cast<float>(BANDS);
+		band.mHi = mDepth * static_cast<float>(k + 1) / static_cast<float>(BANDS);
+		span_x[k] = std::fabs(far_x + slope_x * band.mLo);
+		span_y[k] = std::fabs(far_y + slope_y * band.mLo);
+		span_z[k] = (band.mHi - band.mLo) * depth_world;
+	}
+
+	// Grow every cell until there are no more than there are instances,
+	// though each band always has one.
+	const double			budget = static_cast<double>(std::max(instances, BANDS));
+	double					counts[BANDS][3];
+	float					grow = 1.0f;
+	while (true) {
+		double				total = 0.0;
+		for (size_t k=0; k<BANDS; ++k) {
+			const float		cell = particle_size * static_cast<float>(1 << (BANDS - k)) * grow;
+			counts[k][0] = cells_for(span_x[k], cell);
+			counts[k][1] = cells_for(span_y[k], cell);
+			counts[k][2] = cells_for(span_z[k], cell);
+			total += counts[k][0] * counts[k][1] * counts[k][2];
+		}
+		if (total <= budget) break;
+		// Rounding up can leave a few too many, so always grow some.
+		grow *= static_cast<float>(std::max(1.01, std::cbrt(total / budget)));
+	}
+
+	size_t					cells = 0,
+							slices = 0;
+	for (size_t k=0; k<BANDS; ++k) {
+		Band&				band(mBands[k]);
+		band.mCellsX = static_cast<uint32_t>(counts[k][0]);
+		band.mCellsY = static_cast<uint32_t>(counts[k][1]);
+		band.mCellsZ = static_cast<uint32_t>(counts[k][2]);
+		// The budget, and rounding, can make cells wider than asked. An
+		// impostor covers its cell, plus the half particle its members
+		// reach past each edge.
+		const float			wide = std::max(std::max(span_x[k] / band.mCellsX, span_y[k] / band.mCellsY), span_z[k] / band.mCellsZ);
+		const float			size = (particle_size > 0.0f ? wide / particle_size + 1.0f : 1.0f);
+		band.mSize = static_cast<uint8_t>(std::min(255.0f, std::max(2.0f, size + 0.5f)));
+		band.mFirstCell = cells;
+		band.mFirstSlice = slices;
+		cells += static_cast<size_t>(band.mCellsX) * band.mCellsY * band.mCellsZ;
+		slices += band.mCellsZ;
+	}
+	mSlices = slices;
+	// New cells start clear.
+	mCells.resize(cells);
+	mTouched.resize(mSlices);
+
+	// Each chunk clears its own lists, keeping their memory.
+	mChunks.resize(chunks);
+	for (auto& c : mChunks) c.resize(mSlices);
+	mTaken = 0;
+}
+
+size_t ClusterLod::take(const size_t chunk, Instance *instances, uint32_t *colors, const size_t count) {
+	std::vector<std::vector<Entry>>&	out(mChunks[chunk]);
+	for (auto& s : out) s.clear();
+	if (!(mDepth > 0.0f)) return count;
+
+	const float				far_z = mDepth * UNORM16,
+							band_scale = static_cast<float>(BANDS) / mDepth;
+	size_t					n = 0;
+	for (size_t k=0; k<count; ++k) {
+		const Instance		i(instances[k]);
+		const uint32_t		clr = (colors ? colors[k] : RGBA8_WHITE);
+		if (static_cast<float>(i.mZ) >= far_z) {
+			instances[n] = i;
+			if (colors) colors[n] = clr;
+			++n;
+			continue;
+		}
+
+		const float			uz = static_cast<float>(i.mZ) / UNORM16;
+		const size_t		b = std::min(BANDS - 1, static_cast<size_t>(uz * band_scale));
+		const Band&			band(mBands[b]);
+		const float			fz = (uz - band.mLo) / (band.mHi - band.mLo) * static_cast<float>(band.mCellsZ);
+		const uint32_t		iz = std::min(band.mCellsZ - 1, static_cast<uint32_t>(std::max(fz, 0.0f))),
+							iy = cell_of(i.mY, band.mCellsY),
+							ix = cell_of(i.mX, band.mCellsX);
+		Entry				e;
+		e.mCell = static_cast<uint32_t>(band.mFirstCell + (static_cast<size_t>(iz) * band.mCellsY + iy) * band.mCellsX + ix);
+		e.mInstance = i;
+		e.mColor = clr;
+		out[band.mFirstSlice + iz].push_back(e);
+	}
+	return n;
+}
+
+void ClusterLod::end() {
+	mSliceOut.resize(mSlices);
+	kt::async::parallel_for(0, mSlices, 1, [this](const size_t begin, const size_t end) {
+		for (size_t s=begin; s<end; ++s) {
+			size_t			b = 0;
+			while (b+1 < BANDS && s >= mBands[b+1].mFirstSlice) ++b;
+			const Band&		band(mBands[b]);
+			std::vector<uint32_t>&	touched(mTouched[s]);
+			touched.clear();
+
+			for (const auto& chunk : mChunks) {
+				for (const auto& e : chunk[s]) {
+					Cell&	c(mCells[e.mCell]);
+					const float	a = static_cast<float>(e.mInstance.mAlpha);
+					if (c.mCount++ == 0) {
+						c.mFirst = e.mInstance;
+						c.mFirstColor = e.mColor;
+						touched.push_back(e.mCell);
+					}
+					c.mAlpha += a;
+					c.mX += a * static_cast<float>(e.mInstance.mX);
+					c.mY += a * static_cast<float>(e.mInstance.mY);
+					c.mZ += a * static_cast<float>(e.mInstance.mZ);
+					c.mR += a * static_cast<float>(e.mColor & 0xff);
+					c.mG += a * static_cast<float>((e.mColor >> 8) & 0xff);
+					c.mB += a * static_cast<float>((e.mColor >> 16) & 0xff);
+				}
+			}
+
+			// The splat's alpha is the members' spread over its area. Where
+			// that would be fainter than the faintest alpha there is, the
+			// splat shrinks instead, so the members' total is kept.
+			std::vector<Entry>&	out(mSliceOut[s]);
+			out.clear();
+			const float		area = static_cast<float>(band.mSize) * static_cast<float>(band.mSize);
+			for (const uint32_t t : touched) {
+				Cell&		c(mCells[t]);
+				Entry		e;
+				e.mCell = 0;
+				bool		keep = true;
+				if (c.mCount == 1) {
+					e.mInstance = c.mFirst;
+					e.mColor = c.mFirstColor;
+				} else if (c.mCount > 1 && c.mAlpha > 0.0f) {
+					const float	inv = 1.0f / c.mAlpha;
+					e.mInstance.mX = static_cast<uint16_t>(c.mX * inv + 0.5f);
+					e.mInstance.mY = static_cast<uint16_t>(c.mY * inv + 0.5f);
+					e.mInstance.mZ = static_cast<uint16_t>(c.mZ * inv + 0.5f);
+					uint8_t	size = band.mSize;
+					if (c.mAlpha < area) size = static_cast<uint8_t>(std::max(2.0f, std::floor(std::sqrt(c.mAlpha))));
+					e.mInstance.mAlpha = std::max<uint8_t>(1, to_unorm8(c.mAlpha / (static_cast<float>(size) * size)));
+					e.mInstance.mSize = size;
+					e.mColor = to_rgba8(to_unorm8(c.mR * inv), to_unorm8(c.mG * inv), to_unorm8(c.mB * inv));
+				} else {
+					keep = false;
+				}
+				// Clear it for next frame.
+				std::memset(&c, 0, sizeof(Cell));
+				if (keep) out.push_back(e);
+			}
+		}
+	});
+
+	size_t					total = 0;
+	mTaken = 0;
+	for (const auto& out : mSliceOut) total += out.size();
+	for (const auto& chunk : mChunks) {
+		for (const auto& s : chunk) mTaken += s.size();
+	}
+	mImpostors.resize(total);
+	mImpostorColors.resize(total);
+	size_t					n = 0;
+	for (const auto& out : mSliceOut) {
+		for (const auto& e : out) {
+			mImpostors[n] = e.mInstance;
+			mImpostorColors[n] = e.mColor;
+			++n;
+		}
+	}
+}
+
+} // namespace cs
@@ -0,0 +1,106 @@
+#ifndef CS_CLUSTERLOD_H_
+#define CS_CLUSTERLOD_H_
+
+#include <cstdint>
+#include <vector>
+#include "instance_packer.h"
+
+namespace cs {
+
+/**
+ * @class cs::ClusterLod
+ * @brief Draw clusters of far particles as single, larger impostors.
+ * @description Instances at the back of the packing bounds are small,
+ * faint and overlapping, so I gather them on a grid and draw each cell's
+ * worth as one splat at their alpha-weighted centroid, in their average
+ * color, with their alpha spread over its area. The far slab is split into
+ * bands, and each band nearer the camera has cells half as wide, so
+ * clusters split up as they approach, until they're single particles
+ * again in front of the slab. A cell holding one instance keeps it as is.
+ *
+ * There are never more cells than instances being packed, since most of
+ * them would be empty; when there would be, every cell grows alike.
+ *
+ * The grid is split into depth slices, and each chunk sorts what it takes
+ * by slice, so the slices can be merged concurrently. Each slice notes
+ * the cells it touches, so only those are read out and cleared.
+ *
+ * A frame is begin(), then take() on any number of chunks, concurrently,
+ * then end(), which leaves the impostors in getImpostors().
+ */
+class ClusterLod {
+public:
+	ClusterLod();
+
+	// Start a frame of chunks, quantized by packer, holding instances in
+	// all. Particle size is in world units. Depth is how far into the bounds,
+	// from the back, to cluster, as a fraction of their depth.
+	void				begin(	const InstancePacker&, const float particle_size,
+								const float depth, const size_t instances, const size_t chunks);
+	// Take the far instances out of count, and their colors if there are
+	// any, compacting the rest in place. Answer how many are left.
+	size_t				take(const size_t chunk, Instance*, uint32_t *colors, const size_t count);
+	// Merge everything taken into impostors.
+	void				end();
+
+	const std::vector<Instance>&	getImpostors() const { return mImpostors; }
+	const std::vector<uint32_t>&	getImpostorColors() const { return mImpostorColors; }
+	// How many instances went into the impostors.
+	size_t				getTaken() const { return mTaken; }
+
+private:
+	// Bands in the far slab. Cells in the farthest are 2^BANDS particles wide.
+	static const size_t	BANDS = 2;
+
+	class Band {
+	public:
+		Band() { }
+
+		// Unit z range, and how to scale into cells.
+		float			mLo = 0.0f,
+						mHi = 0.0f;
+		uint32_t		mCellsX = 1,
+						mCellsY = 1,
+						mCellsZ = 1;
+		// The first cell and slice of the band, across all bands.
+		size_t			mFirstCell = 0,
+						mFirstSlice = 0;
+		// Impostor size, in particles.
+		uint8_t			mSize = 1;
+	};
+
+	class Entry {
+	public:
+		uint32_t		mCell;
+		Instance		mInstance;
+		uint32_t		mColor;
+	};
+
+	class Cell {
+	public:
+		// Alpha, and alpha-weighted unit position and color channels.
+		float			mAlpha, mX, mY, mZ, mR, mG, mB;
+		uint32_t		mCount;
+		Instance		mFirst;
+		uint32_t		mFirstColor;
+	};
+
+	float				mDepth = 0.0f;
+	Band				mBands[BANDS];
+	size_t				mSlices = 0;
+	// What each chunk took, by slice.
+	std::vector<std::vector<std::vector<Entry>>>	mChunks;
+	// Every cell is clear outside end().
+	std::vector<Cell>	mCells;
+	// The cells each slice touched this frame.
+	std::vector<std::vector<uint32_t>>	mTouched;
+	// Each slice's impostors, then all of them.
+	std::vector<std::vector<Entry>>	mSliceOut;
+	std::vector<Instance>	mImpostors;
+	std::vector<uint32_t>	mImpostorColors;
+	size_t				mTaken = 0;
+};
+
+} // namespace cs
+
+#endif
@@ -1,17 +1,72 @@
 #include "cs_app.h"
 
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <sstream>
 #include <cinder/app/RendererGl.h>
+#include <cinder/Filesystem.h>
 #include <cinder/gl/gl.h>
-#include "kt/app/kt_environment.h"
+#include <cinder/ImageIo.h>
+#include "kt/async/thread_attributes.h"
+#include "kt/async/thread_pool.h"
+#include "image_compare.h"
+#include "packing_check.h"
+#include "program_cache.h"
 
 namespace cs {
 
+namespace {
+// Particles added or removed by the +/- keys.
+const size_t		PARTICLE_COUNT_STEP = 1000;
+
+// Times each path draws when benchmarking.
+const size_t		BENCHMARK_DRAWS = 50;
+
+// Set by a failed check, for main() to return.
+int					exit_code = 0;
+
+// The data the frame stages share.
+enum Resource		{ kFeeder, kParticles, kAccents, kStaging, kFbo, kScreen };
+
+// Answer the GPU milliseconds fn's commands take, or a negative number
+// if the GL has no timer queries (ES). Blocks until they're done.
+double				gpu_ms(const std::function<void(void)> &fn) {
+#if defined( CINDER_GL_ES )
+	fn();
+	return -1.0;
+#else
+	GLuint			query = 0;
+	glGenQueries(1, &query);
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	fn();
+	glEndQuery(GL_TIME_ELAPSED);
+	GLuint64		ns = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+	glDeleteQueries(1, &query);
+	return static_cast<double>(ns) / 1000000.0;
+#endif
+}
+}
+
 BasicApp::BasicApp()
 		: mPicker(mCamera)
 		, mFeeder(mCns, mSettings)
 		, mParticleView(mCns, mSettings, mFeeder)
 		, mBackground(mSettings, glm::ivec2(getWindowWidth(), getWindowHeight())) {
-	
+	mSettings.readArgs(getCommandLineArgs());
+
+	// SETUP THREADS
+	kt::async::ThreadAttributes	main_thread(mSettings.mMainThread),
+								pool_threads(mSettings.mPoolThreads);
+	main_thread.mName = "main";
+	pool_threads.mName = "pool";
+	main_thread.apply();
+	kt::async::ThreadPool::shared().setAttributes(pool_threads);
+	// Printing here creates an error, so setup() reports it.
+	mLockFailed = mSettings.mLockMemory && !kt::async::lock_memory();
+
 	// SETUP PICKER
 	const glm::vec2		window_size(static_cast<float>(getWindowWidth()), static_cast<float>(getWindowHeight()));
 	mPicker.setTo(window_size);
@@ -19,10 +74,20 @@ BasicApp::BasicApp()
 	// SETUP CAMERA
 	mCameraOrtho.setOrtho(0.0f, window_size.x, window_size.y, 0.0f, -1.0f, 1.0f);
 
+	// SETUP METRICS
+	setupWorldBounds(mSettings.mRangeZ, mCns);
+
+	// START PARTICLES
+	// The first frame generates on the feeder while the rest of startup
+	// happens here. The background, the jot image and the generator's
+	// source image are already on the pool. A bake happens in setup(),
+	// nothing runs live.
+	if (mSettings.mShowMode != cs::Settings::ShowMode::kBake) {
+		mParticleView.initializeParticles();
+	}
+
 	// SETUP FBO
-	ci::gl::Fbo::Format format;
-	mFbo = ci::gl::Fbo::create(getWindowWidth(), getWindowHeight(), true, false, false); //format.disableDepth() );
-	if (!mFbo) throw std::runtime_error("App can't create FBO");
+	mFbo = makeFbo(mSettings.mRenderScale);
 
 	// SETUP BATCH
 	const glm::vec2			tc_ul(0.0f, 0.0f),
@@ -30,19 +95,30 @@ BasicApp::BasicApp()
 							tc_lr(1.0f, 1.0f),
 							tc_ll(0.0f, 1.0f);
 	ci::gl::VboMeshRef		mesh = ci::gl::VboMesh::create(ci::geom::Rect(ci::Rectf(0, 0, window_size.x, window_size.y)).texCoords(tc_ul, tc_ur, tc_lr, tc_ll));
-	auto glsl = ci::gl::GlslProg::create(	ci::loadFile(kt::env::expand("$(DATA)/shaders/saturate.vert")),
-											ci::loadFile(kt::env::expand("$(DATA)/shaders/saturate.frag")) );
+	auto glsl = ProgramCache::shared().load("$(DATA)/shaders/saturate.vert", "$(DATA)/shaders/saturate.frag");
 	if (!glsl) throw std::runtime_error("App can't create shader");
 	mBatch = ci::gl::Batch::create(mesh, glsl);
+	glsl->uniform("uColored", mSettings.mParticleColors ? 1 : 0);
+	glsl->uniform("uUpscale", mSettings.mUpscale == cs::Settings::Upscale::kBicubic ? 1 : 0);
 
-	// SETUP METRICS
-	setupWorldBounds(mSettings.mRangeZ, mCns);
+	// SETUP FRAME
+	setupGraphs();
 
-	mParticleView.initializeParticles();
+	mConstructedSeconds = mStartClock.elapsed();
 }
 
 void BasicApp::prepareSettings(Settings* s) {
 	if (s) {
+		cs::Settings	settings;
+		settings.readArgs(s->getCommandLineArgs());
+		if (settings.mHeadless) {
+			// The window is the render target. Don't wait on the display
+			// between frames.
+			s->setWindowSize(settings.mHeadlessSize);
+			s->setFullScreen(false);
+			s->disableFrameRate();
+			return;
+		}
 //		s->setTitle("C. Clara Run");
 		s->setWindowSize(glm::ivec2(1920, 1080));
 		s->setFullScreen(true);
@@ -54,6 +130,45 @@ void BasicApp::setup() {
 	base::setup();
 	// Printing during construction creates an error, so clear that out, in case anyone did.
 	std::cout.clear();
+	mSetUpSeconds = mStartClock.elapsed();
+	if (mLockFailed) std::cout << "App can't lock memory" << std::endl;
+
+	// How much of startup went to shaders, cold or warm.
+	const ProgramCache::Stats&	shaders(ProgramCache::shared().getStats());
+	std::cout << "Loaded " << shaders.mLoaded << " shader programs, " << shaders.mCached << " from the cache, in "
+			  << (shaders.mSeconds * 1000.0) << " ms" << std::endl;
+
+	if (mSettings.mShowMode == cs::Settings::ShowMode::kBake) {
+		mFeeder.bake(mSettings.mShowPath, mSettings.mShowFrames);
+		std::cout << "Baked " << mSettings.mShowFrames << " frames to " << mSettings.mShowPath << std::endl;
+		quit();
+	} else if (mSettings.mCheckPacking) {
+		if (!checkPacking()) exit_code = 1;
+		quit();
+	} else if (mSettings.mHeadless) {
+		ci::gl::enableVerticalSync(false);
+		if (!mSettings.mDumpPath.empty()) ci::fs::create_directories(ci::fs::path(mSettings.mDumpPath));
+		// A one-shot run quits before any frames are timed.
+		if (!mSettings.mCompareScale && !mSettings.mBenchmarkPoints) {
+			std::cout << "Headless: " << mSettings.mHeadlessFrames << " frames at " << getWindowWidth()
+					  << "x" << getWindowHeight() << std::endl;
+		}
+	}
+}
+
+void BasicApp::resize() {
+	base::resize();
+
+	// Anything generated for the old bounds is stale.
+	const glm::vec2		window_size(static_cast<float>(getWindowWidth()), static_cast<float>(getWindowHeight()));
+	const kt::math::Cube	bounds(mCns.mWorldBounds);
+	mPicker.setTo(window_size);
+	setupWorldBounds(mSettings.mRangeZ, mCns);
+	if (bounds != mCns.mWorldBounds) mParticleView.invalidate();
+
+	// The particle buffer follows the window.
+	const ci::gl::FboRef	fbo = makeFbo(mSettings.mRenderScale);
+	if (!mFbo || fbo->getSize() != mFbo->getSize()) mFbo = fbo;
 }
 
 void BasicApp::mouseDrag(ci::app::MouseEvent event ) {
@@ -64,6 +179,39 @@ void BasicApp::keyDown(ci::app::KeyEvent event ) {
 		// Toggle full screen when the user presses the 'f' key.
 		setFullScreen( ! isFullScreen() );
 	}
+	else if( event.getChar() == '=' || event.getChar() == '+' || event.getChar() == '-' ) {
+		// Tune the particle count while running. The feeder cancels every
+		// frame in flight through the old params' cancel token, drops the
+		// frames ahead, and starts a new generation from where the
+		// particles are headed.
+		const size_t	step = PARTICLE_COUNT_STEP;
+		if (event.getChar() == '-') {
+			if (mSettings.mParticleCount <= step) return;
+			mSettings.mParticleCount -= step;
+		} else {
+			mSettings.mParticleCount += step;
+		}
+		mParticleView.invalidate();
+	}
+	else if( event.getChar() == 't' ) {
+		// Print how long each stage of the last frame took.
+		std::cout << "update ";
+		mUpdateGraph.print(std::cout);
+		std::cout << "draw ";
+		mDrawGraph.print(std::cout);
+		const cs::ParticleRender::Stats&	stats(mParticleView.getRenderStats());
+		std::cout << "culled " << stats.mCulled << " of " << stats.mPacked << " instances ("
+				  << (stats.getCulledFraction() * 100.0f) << "%), thinned " << stats.mThinned
+				  << " (" << (stats.getThinnedFraction() * 100.0f) << "%), clustered " << stats.mClustered
+				  << " (" << (stats.getClusteredFraction() * 100.0f) << "%) into " << stats.mImpostors
+				  << " impostors, drew " << stats.getDrawn() << std::endl;
+	}
+	else if( event.getChar() == 'c' ) {
+		compareRenderScale(mSettings.mComparePath);
+	}
+	else if( event.getChar() == 'b' ) {
+		benchmarkPoints();
+	}
 	else if( event.getCode() == ci::app::KeyEvent::KEY_ESCAPE ) {
 		// Exit full screen, or quit the application, when the user presses the ESC key.
 		if( isFullScreen() )
@@ -74,30 +222,69 @@ void BasicApp::keyDown(ci::app::KeyEvent event ) {
 }
 
 void BasicApp::onUpdate() {
-	mBackground.update();
-	mFeeder.update();
-	mParticleView.update();
+	mUpdateGraph.run();
 }
 
 void BasicApp::onDraw() {
-	// Draw to framebuffer
-	{
-		ci::gl::ScopedFramebuffer fbScp(mFbo);
-		ci::gl::clear();
-		ci::gl::clear(ci::ColorA(0, 0, 0, 0));
-		ci::gl::ScopedViewport scpVp(glm::ivec2(0), mFbo->getSize());
-		ci::gl::setMatrices(mCamera);
-		mParticleView.draw();
+	// A headless run times from the first frame with particles.
+	const bool				timed = mSettings.mHeadless && mStartupReported;
+	if (timed) mFrameTimes.beginGpu();
+	mDrawGraph.run();
+	if (timed) {
+		mFrameTimes.endGpu();
+		headlessFrame();
 	}
+	if (!mStartupReported) {
+		markStartup();
+		if (mStartupReported) firstParticles();
+	}
+}
 
-	// Draw the framebuffer
-	ci::gl::setMatrices(mCameraOrtho);
-	mBackground.draw();
+void BasicApp::firstParticles() {
+	if (mSettings.mCompareScale) {
+		if (!compareRenderScale(mSettings.mComparePath)) exit_code = 1;
+		quit();
+	} else if (mSettings.mBenchmarkPoints) {
+		benchmarkPoints();
+		quit();
+	}
+}
 
-	mFbo->bindTexture();
-	ci::gl::color(1, 1, 1);
-	mBatch->draw();
-	mFbo->unbindTexture();
+void BasicApp::headlessFrame() {
+	mFrameTimes.add(mUpdateGraph.getFrameSeconds(), mDrawGraph.getFrameSeconds());
+	const size_t			frame = mFrameTimes.getCount() - 1;
+	if (!mSettings.mDumpPath.empty() && frame % mSettings.mDumpEvery == 0) {
+		std::ostringstream	name;
+		name << "frame_" << std::setfill('0') << std::setw(5) << frame << ".png";
+		ci::writeImage((ci::fs::path(mSettings.mDumpPath) / name.str()).string(), ci::app::copyWindowSurface());
+		// Saving isn't part of the next frame.
+		mFrameTimes.restartInterval();
+	}
+	if (mFrameTimes.getCount() < mSettings.mHeadlessFrames) return;
+
+	mFrameTimes.finish();
+	std::cout << "Headless run of " << mFrameTimes.getCount() << " frames at " << getWindowWidth()
+			  << "x" << getWindowHeight() << ", render scale " << mSettings.mRenderScale << std::endl;
+	mFrameTimes.print(std::cout);
+	std::cout << "update ";
+	mUpdateGraph.print(std::cout);
+	std::cout << "draw ";
+	mDrawGraph.print(std::cout);
+	const cs::ParticleRender::Stats&	stats(mParticleView.getRenderStats());
+	std::cout << "last frame drew " << stats.getDrawn() << " of " << stats.mPacked << " instances" << std::endl;
+	quit();
+}
+
+void BasicApp::markStartup() {
+	const double			now = mStartClock.elapsed();
+	if (mFirstFrameSeconds < 0.0) mFirstFrameSeconds = now;
+	// Particles are on screen from the first draw that has any.
+	if (mParticleView.getSubmitted() < 1) return;
+
+	mStartupReported = true;
+	std::cout << "Startup: constructed at " << (mConstructedSeconds * 1000.0) << " ms, set up at "
+			  << (mSetUpSeconds * 1000.0) << " ms, first frame at " << (mFirstFrameSeconds * 1000.0)
+			  << " ms, first particles at " << (now * 1000.0) << " ms" << std::endl;
 }
 
 void BasicApp::setupWorldBounds(const kt::math::Rangef &rz, kt::Cns &cns) const {
@@ -127,7 +314,151 @@ void BasicApp::setupWorldBounds(const kt::math::Rangef &rz, kt::Cns &cns) const
 	cns.mWorldBounds.mFarUR += far_exp;
 }
 
+void BasicApp::setupGraphs() {
+	typedef kt::async::FrameGraph::Thread	Thread;
+
+	// UPDATE
+	// The feeder hands frames over on the main thread. Accents don't depend
+	// on the main particles until it's time to spawn more, so they fall
+	// while the particles move. Spawning is too small for the pool.
+	mUpdateGraph.add("feeder", {}, {kFeeder}, Thread::kMain, [this]() { mFeeder.update(); });
+	mUpdateGraph.add("stage", {}, {kFeeder, kParticles}, Thread::kMain, [this]() { mParticleView.updateStage(); });
+	mUpdateGraph.add("accents", {}, {kAccents}, Thread::kAny, [this]() { mParticleView.updateAccents(); });
+	mUpdateGraph.add("particles", {}, {kParticles}, Thread::kAny, [this]() { mParticleView.updateParticles(); });
+	mUpdateGraph.add("spawn", {kParticles}, {kAccents}, Thread::kMain, [this]() { mParticleView.spawnAccents(); });
+
+	// DRAW
+	// Pack the particles on the pool while the background draws.
+	mDrawGraph.add("pack", {kParticles, kAccents}, {kStaging}, Thread::kAny, [this]() { mParticleView.pack(); });
+	mDrawGraph.add("background", {}, {kScreen}, Thread::kMain, [this]() {
+		ci::gl::setMatrices(mCameraOrtho);
+		mBackground.draw();
+	});
+	mDrawGraph.add("particles", {kStaging}, {kFbo}, Thread::kMain, [this]() { drawParticles(mFbo, mSettings.mRenderScale); });
+	mDrawGraph.add("composite", {kFbo}, {kScreen}, Thread::kMain, [this]() { composite(mFbo); });
+}
+
+ci::gl::FboRef BasicApp::makeFbo(const float scale) const {
+	const int				w = std::max(1, static_cast<int>(std::round(getWindowWidth() * scale))),
+							h = std::max(1, static_cast<int>(std::round(getWindowHeight() * scale)));
+	ci::gl::FboRef			fbo = ci::gl::Fbo::create(w, h, true, false, false);
+	if (!fbo) throw std::runtime_error("App can't create FBO");
+	return fbo;
+}
+
+void BasicApp::drawParticles(const ci::gl::FboRef &fbo, const float scale) {
+	ci::gl::ScopedFramebuffer fbScp(fbo);
+	ci::gl::clear();
+	ci::gl::clear(ci::ColorA(0, 0, 0, 0));
+	ci::gl::ScopedViewport scpVp(glm::ivec2(0), fbo->getSize());
+	ci::gl::ScopedMatrices scpMat;
+	ci::gl::setMatrices(mCamera);
+	mParticleView.submit(scale);
+}
+
+void BasicApp::composite(const ci::gl::FboRef &fbo) {
+	// The batch covers the window, so a smaller buffer is scaled up.
+	ci::gl::setMatrices(mCameraOrtho);
+	fbo->bindTexture();
+	ci::gl::color(1, 1, 1);
+	mBatch->draw();
+	fbo->unbindTexture();
+}
+
+ci::Surface8u BasicApp::renderComposite(const float scale) {
+	const ci::gl::FboRef	particles = makeFbo(scale),
+							target = makeFbo(1.0f);
+	drawParticles(particles, scale);
+
+	ci::gl::ScopedFramebuffer	fbScp(target);
+	ci::gl::ScopedViewport	scpVp(glm::ivec2(0), target->getSize());
+	ci::gl::ScopedMatrices	scpMat;
+	// Keep the composite's own alpha, not a blend of it.
+	ci::gl::ScopedBlend		scpBlend(false);
+	ci::gl::clear(ci::ColorA(0, 0, 0, 0));
+	composite(particles);
+	return target->readPixels8u(target->getBounds());
+}
+
+bool BasicApp::compareRenderScale(const std::string &dir) {
+	const float				scale = mSettings.mRenderScale;
+	const ci::Surface8u		full = renderComposite(1.0f),
+							scaled = renderComposite(scale);
+	const ImageDiff			diff = compare_images(full, scaled);
+	std::cout << "render scale " << scale << " fills " << (scale * scale * 100.0f) << "% of the pixels: mean error "
+			  << diff.mMeanAbs << ", rms " << diff.mRms << ", max " << diff.mMax << ", psnr " << diff.mPsnr
+			  << " dB, " << (diff.mChanged * 100.0) << "% of pixels changed" << std::endl;
+	std::cout << "render scale check " << (diff.passed() ? "PASSED" : "FAILED") << " (min psnr " << ImageDiff::MIN_PSNR
+			  << " dB)" << std::endl;
+
+	if (!dir.empty()) {
+		const ci::fs::path	path(dir);
+		ci::fs::create_directories(path);
+		std::ostringstream	name;
+		name << "render_scale_" << scale << ".png";
+		ci::writeImage((path / "render_scale_1.png").string(), full);
+		ci::writeImage((path / name.str()).string(), scaled);
+		std::cout << "saved both to " << dir << std::endl;
+	}
+	return diff.passed();
+}
+
+bool BasicApp::checkPacking() {
+	// The same points every run, at the window size and at 4K.
+	const glm::vec2			sizes[2] = {	glm::vec2(static_cast<float>(getWindowWidth()), static_cast<float>(getWindowHeight())),
+											glm::vec2(3840.0f, 2160.0f) };
+	bool					passed = true;
+	for (const auto& size : sizes) {
+		const PackingCheck	check = check_packing(mCns.mWorldBounds, mCns.mExactWorldBounds, mCamera, size);
+		passed = passed && check.passed();
+		std::cout << "packing at " << size.x << "x" << size.y << ": " << check.mPoints << " points, max "
+				  << check.mMaxPixels << " px, mean " << check.mMeanPixels << " px, paths differ by "
+				  << check.mMaxPathSteps << " steps" << std::endl;
+	}
+	std::cout << "packing check " << (passed ? "PASSED" : "FAILED") << " (max " << PackingCheck::MAX_PIXELS
+			  << " px)" << std::endl;
+	return passed;
+}
+
+void BasicApp::benchmarkPoints() {
+	const float				scale = mSettings.mRenderScale;
+	const cs::ParticleRender::Stats&	stats(mParticleView.getRenderStats());
+	std::cout << "drawing " << stats.getDrawn() << " instances "
+			  << BENCHMARK_DRAWS << " times" << std::endl;
+	for (int points=0; points<2; ++points) {
+		// One draw first, so switching paths isn't timed.
+		mParticleView.setPointSprites(points != 0);
+		drawParticles(mFbo, scale);
+		glFinish();
+
+		const auto			start = std::chrono::steady_clock::now();
+		const double		gpu = gpu_ms([this, scale]() {
+			for (size_t k=0; k<BENCHMARK_DRAWS; ++k) drawParticles(mFbo, scale);
+		});
+		const std::chrono::duration<double>	cpu(std::chrono::steady_clock::now() - start);
+		std::cout << "\t" << (points ? "points" : "quads ") << " gpu ";
+		if (gpu < 0.0) std::cout << "n/a";
+		else std::cout << (gpu / BENCHMARK_DRAWS) << " ms";
+		std::cout << ", cpu " << (cpu.count() * 1000.0 / BENCHMARK_DRAWS) << " ms per draw" << std::endl;
+	}
+	mParticleView.setPointSprites(mSettings.mPointSprites);
+}
+
+int BasicApp::getExitCode() {
+	return exit_code;
+}
+
 } // namespace cs
 
 // This line tells Cinder to actually create and run the application.
-CINDER_APP(cs::BasicApp, ci::app::RendererGl, cs::BasicApp::prepareSettings)
\ No newline at end of file
+// On Windows it's CINDER_APP spelled out, so a failed check is the exit
+// code.
+#if defined( CINDER_MSW )
+int __stdcall WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
+	cinder::app::RendererRef	renderer(new ci::app::RendererGl());
+	cinder::app::AppMsw::main<cs::BasicApp>(renderer, "cs::BasicApp", cs::BasicApp::prepareSettings);
+	return cs::BasicApp::getExitCode();
+}
+#else
+CINDER_APP(cs::BasicApp, ci::app::RendererGl, cs::BasicApp::prepareSettings)
+#endif
\ No newline at end of file
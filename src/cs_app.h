@@ -4,8 +4,11 @@
 #include <cinder/gl/Batch.h>
 #include <cinder/gl/Fbo.h>
 #include "kt/app/kt_app.h"
+#include "kt/async/frame_graph.h"
+#include "kt/time/seconds.h"
 #include "background.h"
 #include "feeder.h"
+#include "frame_times.h"
 #include "particle_view.h"
 #include "picker_3d.h"
 #include "settings.h"
@@ -19,8 +22,12 @@ class BasicApp : public kt::App {
 public:
 	BasicApp();
 
+	// What the process exits with: 0, or 1 if a check failed.
+	static int					getExitCode();
+
 	static void					prepareSettings(Settings*);
 	void						setup() override;
+	void						resize() override;
 
 	void						mouseDrag(ci::app::MouseEvent) override;
 	void						keyDown(ci::app::KeyEvent) override;
@@ -32,9 +39,46 @@ protected:
 
 private:
 	void						setupWorldBounds(const kt::math::Rangef&, kt::Cns&) const;
+	void						setupGraphs();
+	// Note the time to the first frame, and to the first with particles.
+	void						markStartup();
+	// Run whatever was asked for on the first frame with particles, and
+	// quit if it was.
+	void						firstParticles();
+	// Time a headless frame, save it if asked, and print the run and
+	// quit after the last one.
+	void						headlessFrame();
+	// Answer a particle buffer scale times the window size.
+	ci::gl::FboRef				makeFbo(const float scale) const;
+	void						drawParticles(const ci::gl::FboRef&, const float scale);
+	void						composite(const ci::gl::FboRef&);
+	// Draw the particles at scale and composite them offscreen, without
+	// the background. Answer the window-size result.
+	ci::Surface8u				renderComposite(const float scale);
+	// Print how far the current render scale is from full size, and save
+	// both images to dir, if there is one. Answer true if it's close enough.
+	bool						compareRenderScale(const std::string &dir);
+	// Print how far packing moves a fixed set of points, and whether
+	// that's within the limit. Answer true if it is.
+	bool						checkPacking();
+	// Print how long the GPU takes to draw the current frame's instances
+	// as quads and as point sprites.
+	void						benchmarkPoints();
 
 	using base = kt::App;
 
+	// Time to first frame, in seconds since construction started. The
+	// clock is first so it starts before the other members.
+	kt::time::Seconds			mStartClock;
+	double						mConstructedSeconds = 0.0,
+								mSetUpSeconds = 0.0,
+								mFirstFrameSeconds = -1.0;
+	bool						mStartupReported = false;
+	// Asked to lock memory, and couldn't.
+	bool						mLockFailed = false;
+	// Headless runs only.
+	FrameTimes					mFrameTimes;
+
 	cs::Settings				mSettings;
 	Picker3d					mPicker;
 	Feeder						mFeeder;
@@ -46,6 +90,10 @@ private:
 	ParticleView				mParticleView;
 
 	Background					mBackground;
+
+	// The stages of update() and draw(), run concurrently where they can be.
+	kt::async::FrameGraph		mUpdateGraph;
+	kt::async::FrameGraph		mDrawGraph;
 };
 
 } // namespace cs
@@ -1,7 +1,11 @@
 #include "feeder.h"
 
+#include <sstream>
+#include <stdexcept>
 #include "kt/app/kt_cns.h"
+#include "kt/time/seconds.h"
 #include "settings.h"
+#include "show_file.h"
 
 namespace cs {
 
@@ -9,6 +13,39 @@ namespace {
 void			add_gen(GeneratorRef g, std::vector<GeneratorRef> &out) {
 	if (g) out.push_back(g);
 }
+
+void			make_generators(std::vector<GeneratorRef> &out) {
+	out.clear();
+	add_gen(GeneratorRef(new RandomLineGenerator()), out);
+	add_gen(GeneratorRef(new RandomGenerator()), out);
+	add_gen(GeneratorRef(new ImageGenerator()), out);
+	add_gen(GeneratorRef(new RandomGenerator()), out);
+}
+
+// The seed frame is already at rest.
+void			seed_frame(const GeneratorParams &params, const size_t count, ParticleList &out) {
+	out.resize(count);
+	RandomGenerator		gen(RandomGenerator::Mode::kAnywhere);
+	gen.update(params, out);
+	for (auto& p : out) {
+		p.mCurve.mP0 = p.mCurve.mP3;
+		p.mStartAlpha = p.mEndAlpha = 1.0f;
+		p.mColor = p.mStartColor = p.mEndColor;
+	}
+	out.mTransitionDuration = 0.0;
+	out.mHoldDuration = 0.0;
+}
+
+void			restore_ends(	const std::vector<glm::vec3> &end, const std::vector<float> &end_alpha,
+								const std::vector<uint32_t> &end_color, ParticleList &list) {
+	list.resize(end.size());
+	for (size_t k=0; k<end.size(); ++k) {
+		Particle&	p(list[k]);
+		p.mCurve.mP3 = end[k];
+		p.mEndAlpha = end_alpha[k];
+		p.mEndColor = end_color[k];
+	}
+}
 }
 
 /**
@@ -16,64 +53,218 @@ void			add_gen(GeneratorRef g, std::vector<GeneratorRef> &out) {
  */
 Feeder::Feeder(const kt::Cns &cns, const cs::Settings &s)
 		: mCns(cns)
-		, mSettings(s)
-		, mWorker([this](Op &op){handle(op);}) {
-	add_gen(GeneratorRef(new RandomLineGenerator()), mGeneratorList);
-	add_gen(GeneratorRef(new RandomGenerator()), mGeneratorList);
-	add_gen(GeneratorRef(new ImageGenerator()), mGeneratorList);
-	add_gen(GeneratorRef(new RandomGenerator()), mGeneratorList);
+		, mSettings(s) {
+	makeGenerators();
 	mCurrentGenerator = mGeneratorList.size();
+
+	const size_t		workers = (s.mFeederWorkers > 0 ? s.mFeederWorkers : 1);
+	for (size_t k=0; k<workers; ++k) {
+		std::stringstream	name;
+		name << "feeder " << k;
+		kt::async::ThreadAttributes	attributes(s.mFeederThreads);
+		attributes.mName = name.str();
+		mWorkers.push_back(std::unique_ptr<kt::async::OperatorThread<Op, int>>(
+				new kt::async::OperatorThread<Op, int>([this](Op &op){handle(op);}, attributes)));
+	}
 }
 
-void Feeder::start(const ParticleList &list) {
-	mParams.setTo(mCns);
+Feeder::~Feeder() {
+	// Release any workers waiting their turn, so they can be joined.
+	mChain.stop();
+}
 
-	mWorker.run([this, &list](Op &op) {
-		op.mParams = mParams;
-		op.mGenerator = nextGenerator();
-		op.mParticles = list;
-	});
+void Feeder::start(const size_t count) {
+	if (mSettings.mShowMode == Settings::ShowMode::kPlay) {
+		mShow.reset(new ShowReader(mSettings.mShowPath));
+		mShowFrame = 0;
+		return;
+	}
+
+	publishParams();
+
+	mCount = count;
+	mDepth = depthFor(count);
+	mFrames.clear();
+	mFrames.resize(mDepth);
+	mReady.assign(mDepth, false);
+	mFailed.assign(mDepth, false);
+	mHeadSequence = mNextSequence = 0;
+	mChain.reset();
+
+	submit(true);
+	fill();
 }
 
 void Feeder::update() {
-	mWorker.update();
+	mMetrics.mTransport = kt::async::WorkerStats();
+	for (auto& w : mWorkers) {
+		w->update();
+		mMetrics.mTransport.add(w->getStats());
+	}
+	// Handled ops have let go of their params.
+	mParams.reclaim();
+	mMetrics.mParamsVersion = mParams.getVersion();
+	mMetrics.mRetiredParams = mParams.getRetiredCount();
 }
 
 void Feeder::handle(Op &op) {
-	mHasFrame = true;
-	mFrame.swap(op.mParticles);
-	mFrame.setParametersFrom(op.mParticles);
+	// Recycled ops shouldn't keep old params alive.
+	const bool			stale = (!op.mParams || op.mParams->cancelled());
+	op.mParams.release();
+
+	if (op.mStatus == Op::Status::kReplaced) {
+		++mMetrics.mDropped;
+		return;
+	} else if (op.mStatus == Op::Status::kCancelled) {
+		++mMetrics.mCancelled;
+		mMetrics.mWastedSeconds += op.mSeconds;
+		return;
+	} else if (stale) {
+		++mMetrics.mDiscarded;
+		mMetrics.mWastedSeconds += op.mSeconds;
+		return;
+	}
+
+	const size_t		slot = op.mSequence % mDepth;
+	if (op.mStatus == Op::Status::kFailed) {
+		// Nothing to deliver; the client skips the sequence.
+		++mMetrics.mFailed;
+		mMetrics.mWastedSeconds += op.mSeconds;
+		mFailed[slot] = true;
+		skipFailed();
+		return;
+	}
+	mFrames[slot].swap(op.mParticles);
+	mReady[slot] = true;
+}
+
+void Feeder::skipFailed() {
+	bool				skipped = false;
+	while (!mFailed.empty() && mFailed[mHeadSequence % mDepth]) {
+		mFailed[mHeadSequence % mDepth] = false;
+		++mHeadSequence;
+		skipped = true;
+	}
+	if (skipped) fill();
+}
+
+bool Feeder::hasFrame() const {
+	if (mShow) return true;
+	if (mReady.empty()) return false;
+	return mReady[mHeadSequence % mDepth];
 }
 
 void Feeder::getFrame(ParticleList &out) {
-	if (!mHasFrame) return;
-
-	const size_t		size = (out.size() <= mFrame.size() ? out.size() : mFrame.size());
-	if (size < 1) return;
-
-	// Copy in the new data
-	Particle*			src(&mFrame.front());
-	Particle*			src_end = src + size;
-	Particle*			dst(&out.front());
-	while (src < src_end) {
-		src->mCurve.mP0 = dst->mPosition;
-		dst->mCurve = src->mCurve;
-		dst->mStartAlpha = src->mStartAlpha;
-		dst->mEndAlpha = src->mEndAlpha;
-		dst->mHasAccents = src->mHasAccents;
-
-		++src;
-		++dst;
-	}
-	out.setParametersFrom(mFrame);
-
-	// Generate the next frame
-	mHasFrame = false;
-	mWorker.run([this](Op &op) {
-		op.mParams = mParams;
-		op.mGenerator = nextGenerator();
-		op.mParticles.swap(mFrame);
-	});
+	if (mShow) {
+		// Decoded straight from the map into the client's list. The show
+		// loops back to its key frame.
+		mShow->read(mShowFrame, out);
+		mShowFrame = (mShowFrame + 1) % mShow->getFrameCount();
+		++mMetrics.mDelivered;
+		return;
+	}
+	if (!hasFrame()) return;
+
+	const size_t		slot = mHeadSequence % mDepth;
+	ParticleList&		frame(mFrames[slot]);
+
+	syncFrame(out, frame);
+
+	// Hand off the new frame. The old one stays in the slot to be recycled.
+	out.swap(frame);
+	mReady[slot] = false;
+	++mHeadSequence;
+	++mMetrics.mDelivered;
+
+	// Generate the next frame, and step over any that failed.
+	fill();
+	skipFailed();
+}
+
+void Feeder::syncFrame(const ParticleList &current, ParticleList &frame) {
+	// The new curves start wherever the particles are right now, which
+	// might not quite be where the last frame predicted.
+	const size_t		size = (current.size() <= frame.size() ? current.size() : frame.size());
+	if (size > 0) {
+		const Particle*	src(&current.front());
+		const Particle*	src_end = src + size;
+		Particle*		dst(&frame.front());
+		while (src < src_end) {
+			dst->mCurve.mP0 = dst->mPosition = src->mPosition;
+			dst->mAlpha = src->mAlpha;
+			dst->mColor = src->mColor;
+
+			++src;
+			++dst;
+		}
+	}
+}
+
+void Feeder::invalidate(const ParticleList &current) {
+	// A baked show is fixed to the bounds it was baked for.
+	if (mShow) return;
+	if (mWorkers.empty() || mFrames.empty()) return;
+
+	// Cancel everything in flight, including anyone waiting their turn.
+	mCancel.cancel();
+	mChain.notify();
+	publishParams();
+
+	// Stale work might still be running for a moment, so don't share
+	// generators with it.
+	makeGenerators();
+
+	// Drop the frames ahead. Sequences keep counting, so stale work
+	// can never land in a slot.
+	for (size_t k=0; k<mReady.size(); ++k) {
+		if (mReady[k]) ++mMetrics.mDiscarded;
+	}
+	mCount = mSettings.mParticleCount;
+	mDepth = depthFor(mCount);
+	mFrames.resize(mDepth);
+	mReady.assign(mDepth, false);
+	mFailed.assign(mDepth, false);
+	mHeadSequence = mNextSequence;
+
+	if (current.empty()) {
+		submit(true);
+	} else {
+		// Continue from where the client is headed. If the count changed,
+		// new particles share the endpoints of existing ones.
+		mRebase = true;
+		mRebaseEnd.resize(mCount);
+		mRebaseEndAlpha.resize(mCount);
+		mRebaseEndColor.resize(mCount);
+		for (size_t k=0; k<mCount; ++k) {
+			const Particle&	p(current[k % current.size()]);
+			mRebaseEnd[k] = p.mCurve.mP3;
+			mRebaseEndAlpha[k] = p.mEndAlpha;
+			mRebaseEndColor[k] = p.mEndColor;
+		}
+	}
+	fill();
+}
+
+void Feeder::bake(const std::string &path, const size_t frames) {
+	const GeneratorParams		params(mCns);
+	// A rotation of its own, so the bake doesn't disturb the workers.
+	std::vector<GeneratorRef>	rotation;
+	make_generators(rotation);
+	if (rotation.empty()) throw std::runtime_error("Feeder has no generators to bake");
+
+	ParticleList				list;
+	seed_frame(params, mSettings.mParticleCount, list);
+	ShowWriter					writer(path, params.mWorldBounds, list.size());
+	writer.write(list);
+	for (size_t k=1; k<frames; ++k) {
+		rotation[(k-1) % rotation.size()]->update(params, list);
+		writer.write(list);
+	}
+	writer.close();
+}
+
+void Feeder::makeGenerators() {
+	make_generators(mGeneratorList);
 }
 
 GeneratorRef Feeder::nextGenerator() {
@@ -84,16 +275,204 @@ GeneratorRef Feeder::nextGenerator() {
 	return mGeneratorList[mCurrentGenerator];
 }
 
+size_t Feeder::depthFor(const size_t count) const {
+	size_t				depth = (mSettings.mFeederLookahead > 0 ? mSettings.mFeederLookahead : 1);
+	const size_t		frame_bytes = count * sizeof(Particle);
+	if (frame_bytes > 0) {
+		// The ring holds every frame ahead, plus the client holds one more.
+		const size_t	frames = mSettings.mFeederMemoryCap / frame_bytes;
+		const size_t	capped = (frames > 1 ? frames-1 : 1);
+		if (capped < depth) depth = capped;
+	}
+	// With more than one worker, frames in flight at once can't share a
+	// generator, and the rotation repeats after every generator's had a turn.
+	if (mWorkers.size() > 1 && depth > mGeneratorList.size() && !mGeneratorList.empty()) {
+		depth = mGeneratorList.size();
+	}
+	return depth;
+}
+
+void Feeder::publishParams() {
+	GeneratorParams		params(mCns);
+	params.mCancel = mCancel.token();
+	mParams.publish(params);
+}
+
+void Feeder::fill() {
+	while (mNextSequence - mHeadSequence < mDepth) {
+		submit(false);
+	}
+}
+
+void Feeder::submit(const bool seed) {
+	if (mWorkers.empty()) return;
+
+	const size_t		sequence = mNextSequence++;
+	const size_t		slot = sequence % mDepth;
+	auto&				worker = mWorkers[sequence % mWorkers.size()];
+	worker->run([this, sequence, slot, seed](Op &op) {
+		op.mStatus = Op::Status::kDone;
+		op.mSeconds = 0.0;
+		op.mChain = &mChain;
+		op.mParams = mParams.acquire();
+		op.mGenerator = (seed ? nullptr : nextGenerator());
+		op.mSequence = sequence;
+		op.mCount = mCount;
+		op.mSeed = seed;
+		op.mRestart = (seed || mRebase);
+		if (mRebase && !seed) {
+			op.mRebaseEnd.swap(mRebaseEnd);
+			op.mRebaseEndAlpha.swap(mRebaseEndAlpha);
+			op.mRebaseEndColor.swap(mRebaseEndColor);
+		}
+		mRebase = false;
+		// Generate into the slot's recycled buffer.
+		op.mParticles.swap(mFrames[slot]);
+	});
+}
+
 /**
  * @class cs::Feeder::Op
  */
 Feeder::Op::Op() {
 }
 
+bool Feeder::Op::replace(Op &earlier, int&) {
+	// Anything from before an invalidate is stale; don't bother running it.
+	if (earlier.mParams && !earlier.mParams->cancelled()) return false;
+	earlier.mStatus = Status::kReplaced;
+	return true;
+}
+
 void Feeder::Op::run(int&) {
-	if (!mGenerator) return;
+	if (!mChain || !mParams) return;
+	const GeneratorParams&	params(*mParams);
+
+	kt::time::Seconds	timer;
+	mStatus = Status::kCancelled;
+	if (params.cancelled()) return;
+
+	// Anything that doesn't depend on the previous frame happens
+	// now, alongside the other workers.
+	bool				failed = false;
+	try {
+		if (!mSeed && mGenerator) mGenerator->prepare(params, mCount);
+	} catch (std::exception const&) {
+		failed = true;
+	}
 
-	mGenerator->update(mParams, mParticles);
+	// Then wait for the previous frame, and continue from it. A failed
+	// frame still takes its turn, so the next frame isn't left waiting.
+	if (!mChain->wait(mSequence, mRestart, params.mCancel)) {
+		mSeconds = timer.elapsed();
+		return;
+	}
+	if (!failed) {
+		try {
+			if (mSeed) {
+				seed_frame(params, mCount, mParticles);
+			} else {
+				if (mRestart) restore_ends(mRebaseEnd, mRebaseEndAlpha, mRebaseEndColor, mParticles);
+				else mChain->restore(mParticles);
+				if (mGenerator) mGenerator->update(params, mParticles);
+			}
+		} catch (std::exception const&) {
+			failed = true;
+		}
+	}
+	mSeconds = timer.elapsed();
+	if (params.cancelled()) {
+		mChain->abandon();
+		return;
+	}
+	if (failed) {
+		// The next frame continues from the last good endpoints.
+		mChain->advance();
+		mStatus = Status::kFailed;
+		return;
+	}
+	mChain->store(mParticles);
+	mChain->advance();
+	mStatus = Status::kDone;
+
+	// Start everyone at the predicted position; the client will sync
+	// to the actual positions when it takes the frame.
+	for (auto& p : mParticles) {
+		p.mPosition = p.mCurve.mP0;
+		p.mAlpha = p.mStartAlpha;
+		p.mColor = p.mStartColor;
+	}
+}
+
+/**
+ * @class cs::Feeder::Chain
+ */
+void Feeder::Chain::reset() {
+	std::lock_guard<std::mutex>		lock(mMutex);
+	mSequence = 0;
+	mBusy = false;
+	mStop = false;
+}
+
+void Feeder::Chain::stop() {
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		mStop = true;
+	}
+	mCondition.notify_all();
+}
+
+bool Feeder::Chain::wait(	const size_t sequence, const bool restart,
+							const kt::async::CancelToken &cancel) {
+	std::unique_lock<std::mutex>	lock(mMutex);
+	mCondition.wait(lock, [&]() {
+		return mStop || cancel.cancelled() || (!mBusy && (restart || mSequence == sequence));
+	});
+	if (mStop || cancel.cancelled()) return false;
+	mBusy = true;
+	mSequence = sequence;
+	return true;
+}
+
+void Feeder::Chain::advance() {
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		mBusy = false;
+		++mSequence;
+	}
+	mCondition.notify_all();
+}
+
+void Feeder::Chain::abandon() {
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		mBusy = false;
+	}
+	mCondition.notify_all();
+}
+
+void Feeder::Chain::notify() {
+	{
+		// Taking the lock means no one can miss the change they're waiting on.
+		std::lock_guard<std::mutex>	lock(mMutex);
+	}
+	mCondition.notify_all();
+}
+
+void Feeder::Chain::restore(ParticleList &list) const {
+	restore_ends(mEnd, mEndAlpha, mEndColor, list);
+}
+
+void Feeder::Chain::store(const ParticleList &list) {
+	mEnd.resize(list.size());
+	mEndAlpha.resize(list.size());
+	mEndColor.resize(list.size());
+	for (size_t k=0; k<list.size(); ++k) {
+		const Particle&		p(list[k]);
+		mEnd[k] = p.mCurve.mP3;
+		mEndAlpha[k] = p.mEndAlpha;
+		mEndColor[k] = p.mEndColor;
+	}
 }
 
 } // namespace cs
@@ -1,32 +1,134 @@
 #ifndef CS_FEEDER_H_
 #define CS_FEEDER_H_
 
+#include <memory>
+#include <string>
+#include "kt/async/cancel_token.h"
+#include "kt/async/snapshot.h"
 #include "kt/async/worker_thread.h"
 #include "generator.h"
 
 namespace cs {
 class Settings;
+class ShowReader;
 
 /**
  * @class cs::Feeder
  * @brief Manage the generation process.
  * @description I manage the parts that actually generate new particle paths, feeding
- * that info to the render.
+ * that info to the render. Frames are handed off by swapping buffers, so the curves
+ * the worker generates become the client's curves without being copied. I keep
+ * a configurable number of frames generated ahead, so a slow generator doesn't
+ * stall the client. Frames are spread across a small set of workers; each frame's
+ * independent work runs concurrently, then frames take turns continuing from the
+ * previous frame's endpoints, and are delivered in order. When the world or
+ * settings change, invalidate() cancels any stale work and publishes a new
+ * snapshot of the generator params; work in flight keeps reading the snapshot
+ * it started with. In play mode, frames
+ * come from a baked show file instead.
  */
 class Feeder {
 public:
 	Feeder() = delete;
 	Feeder(const Feeder&) = delete;
 	Feeder(const kt::Cns&, const cs::Settings&);
+	~Feeder();
 
-	void					start(const ParticleList&);
+	// Start generating. The first frame is a seed frame of count particles
+	// already at rest, after which every frame continues from the last.
+	void					start(const size_t count);
 	void					update();
 
-	bool					hasFrame() const { return mHasFrame; }
-	void					getFrame(ParticleList&);
+	bool					hasFrame() const;
+	// Swap the next frame into out. The particles' current positions become
+	// the start of the new curves, and out's old buffer is recycled.
+	void					getFrame(ParticleList &out);
+	// Start the curves of frame at the particles' current positions. For
+	// clients that take frames from getFrame() somewhere other than the
+	// list that's moving.
+	static void				syncFrame(const ParticleList &current, ParticleList &frame);
+
+	// The world bounds or settings changed. Cancel everything generated or in
+	// flight and start again, continuing from where current is headed.
+	void					invalidate(const ParticleList &current);
+
+	// Run the generator rotation offline, writing frames to a show file.
+	// Blocks until done. Throws on error.
+	void					bake(const std::string &path, const size_t frames);
+
+	// How much work has been thrown away.
+	class Metrics {
+	public:
+		Metrics() { }
+
+		// Frames delivered to the client.
+		size_t				mDelivered = 0;
+		// Frames replaced before they started running.
+		size_t				mDropped = 0;
+		// Frames cancelled while they were running.
+		size_t				mCancelled = 0;
+		// Frames that finished, but were stale by the time they arrived.
+		size_t				mDiscarded = 0;
+		// Frames whose generator threw. They're skipped.
+		size_t				mFailed = 0;
+		// Worker time spent on frames that were cancelled or discarded.
+		double				mWastedSeconds = 0.0;
+		// The current generator params, and old versions still in use.
+		uint64_t			mParamsVersion = 0;
+		size_t				mRetiredParams = 0;
+		// Handoff latency, across all workers.
+		kt::async::WorkerStats	mTransport;
+	};
+	const Metrics&			getMetrics() const { return mMetrics; }
 
 private:
+	void					makeGenerators();
 	GeneratorRef			nextGenerator();
+	// Answer the number of frames to keep ahead for a frame size.
+	size_t					depthFor(const size_t count) const;
+	// Queue generations until the lookahead is full.
+	void					fill();
+	void					submit(const bool seed);
+	// Start a new generation of params.
+	void					publishParams();
+	// Move the head past frames that failed to generate.
+	void					skipFailed();
+
+	// Shared by the workers. Frames take turns, in sequence, continuing
+	// from the endpoints of the last frame generated. Between wait() and
+	// advance() the caller has exclusive access to the endpoints.
+	class Chain {
+	public:
+		Chain() { }
+
+		void				reset();
+		void				stop();
+
+		// Block until it's sequence's turn. A restart takes the next turn
+		// regardless of sequence. Answer false if stopped or cancelled.
+		bool				wait(	const size_t sequence, const bool restart,
+									const kt::async::CancelToken&);
+		// End the current turn.
+		void				advance();
+		// End the current turn without advancing; the work was cancelled.
+		void				abandon();
+		// Wake anyone waiting, so they can check their cancel token.
+		void				notify();
+
+		void				restore(ParticleList&) const;
+		void				store(const ParticleList&);
+
+	private:
+		std::mutex			mMutex;
+		std::condition_variable	mCondition;
+		size_t				mSequence = 0;
+		bool				mBusy = false,
+							mStop = false;
+
+		std::vector<glm::vec3>	mEnd;
+		std::vector<float>	mEndAlpha;
+		std::vector<uint32_t>	mEndColor;
+	};
 
 	class Op;
 	void					handle(Op&);
@@ -35,26 +137,68 @@ private:
 	public:
 		Op();
 
-		bool				replace(Op&, int&) { return false; }
+		bool				replace(Op&, int&);
 		void				run(int&);
 
-		GeneratorParams		mParams;
+		enum class Status	{ kDone, kReplaced, kCancelled, kFailed };
+		Status				mStatus = Status::kDone;
+		// Time spent running.
+		double				mSeconds = 0.0;
+
+		Chain*				mChain = nullptr;
+		// The generation this op belongs to. Read-only on the worker.
+		kt::async::Snapshot<GeneratorParams>::Ref
+							mParams;
 		GeneratorRef		mGenerator;
+		size_t				mSequence = 0;
+		// Size of the frame.
+		size_t				mCount = 0;
+		// If true, generate a seed frame.
+		bool				mSeed = false;
+		// If true, start the chain over from the rebase endpoints.
+		bool				mRestart = false;
+		std::vector<glm::vec3>	mRebaseEnd;
+		std::vector<float>	mRebaseEndAlpha;
+		std::vector<uint32_t>	mRebaseEndColor;
 		ParticleList		mParticles;
+
 	};
 
 	const kt::Cns&			mCns;
 	const cs::Settings&		mSettings;
-	bool					mHasFrame = false;
-	ParticleList			mFrame;
-	GeneratorParams			mParams;
+	// Ring of frames, indexed by sequence. Slots that aren't ready
+	// hold recycled buffers for the next generation.
+	std::vector<ParticleList> mFrames;
+	std::vector<bool>		mReady,
+							mFailed;
+	size_t					mDepth = 1;
+	size_t					mCount = 0;
+	// The next frame to hand off, and the next frame to generate.
+	size_t					mHeadSequence = 0,
+							mNextSequence = 0;
+	// Published on the main thread, read by the workers.
+	kt::async::Snapshot<GeneratorParams>
+							mParams;
+	kt::async::CancelSource	mCancel;
+	// Endpoints for the next generation to restart from, after an invalidate.
+	bool					mRebase = false;
+	std::vector<glm::vec3>	mRebaseEnd;
+	std::vector<float>		mRebaseEndAlpha;
+	std::vector<uint32_t>	mRebaseEndColor;
+	Metrics					mMetrics;
 	std::vector<GeneratorRef> mGeneratorList;
 	size_t					mCurrentGenerator = 0;
 //	GeneratorRef			mRndGenerator;
 //	GeneratorRef			mLineGenerator;
 //	GeneratorRef			mImageGenerator;
 //	GeneratorRef			mCurrentGenerator;
-	kt::async::OperatorThread<Op, int>	mWorker;
+	// The chain must outlive the workers.
+	Chain					mChain;
+	std::vector<std::unique_ptr<kt::async::OperatorThread<Op, int>>>
+							mWorkers;
+	// Play mode.
+	std::unique_ptr<ShowReader>	mShow;
+	size_t					mShowFrame = 0;
 };
 
 } // namespace cs
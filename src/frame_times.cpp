@@ -0,0 +1,106 @@
+#include "frame_times.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+
+namespace cs {
+
+namespace {
+// Frames a GPU time is in flight before it's read.
+const size_t		QUERIES = 4;
+
+// Answer the nearest-rank percentile p (0-1) of sorted values.
+double				percentile(const std::vector<double> &sorted, const double p) {
+	if (sorted.empty()) return 0.0;
+	const size_t	rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+	return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+}
+
+/**
+ * @class cs::FrameTimes
+ */
+FrameTimes::FrameTimes() {
+}
+
+FrameTimes::~FrameTimes() {
+#if ! defined( CINDER_GL_ES )
+	if (!mQueries.empty()) glDeleteQueries(static_cast<GLsizei>(mQueries.size()), mQueries.data());
+#endif
+}
+
+void FrameTimes::beginGpu() {
+#if ! defined( CINDER_GL_ES )
+	if (mQueries.empty()) {
+		mQueries.resize(QUERIES, 0);
+		glGenQueries(static_cast<GLsizei>(mQueries.size()), mQueries.data());
+	}
+	// Free up the oldest query. It's a few frames old, so it's normally done.
+	while (mIssued - mRead >= mQueries.size()) readGpu();
+	glBeginQuery(GL_TIME_ELAPSED, mQueries[mIssued % mQueries.size()]);
+#endif
+}
+
+void FrameTimes::endGpu() {
+#if ! defined( CINDER_GL_ES )
+	glEndQuery(GL_TIME_ELAPSED);
+	++mIssued;
+#endif
+}
+
+void FrameTimes::add(const double update_seconds, const double draw_seconds) {
+	const auto			now = std::chrono::steady_clock::now();
+	if (!mUpdate.empty()) mInterval.push_back(std::chrono::duration<double, std::milli>(now - mLast).count());
+	mLast = now;
+	mUpdate.push_back(update_seconds * 1000.0);
+	mDraw.push_back(draw_seconds * 1000.0);
+}
+
+void FrameTimes::restartInterval() {
+	mLast = std::chrono::steady_clock::now();
+}
+
+void FrameTimes::finish() {
+	while (mRead < mIssued) readGpu();
+}
+
+void FrameTimes::print(std::ostream &out) const {
+	const std::ios::fmtflags	flags(out.flags());
+	out << std::fixed << std::setprecision(2);
+	printSeries(out, "update", mUpdate);
+	printSeries(out, "draw", mDraw);
+#if defined( CINDER_GL_ES )
+	out << "\tgpu        n/a" << std::endl;
+#else
+	printSeries(out, "gpu", mGpu);
+#endif
+	printSeries(out, "interval", mInterval);
+	out.flags(flags);
+}
+
+void FrameTimes::readGpu() {
+#if ! defined( CINDER_GL_ES )
+	GLuint64			ns = 0;
+	glGetQueryObjectui64v(mQueries[mRead % mQueries.size()], GL_QUERY_RESULT, &ns);
+	mGpu.push_back(static_cast<double>(ns) / 1000000.0);
+	++mRead;
+#endif
+}
+
+void FrameTimes::printSeries(std::ostream &out, const std::string &name, const std::vector<double> &ms) {
+	std::vector<double>	sorted(ms);
+	std::sort(sorted.begin(), sorted.end());
+	double				total = 0.0;
+	for (const auto& v : sorted) total += v;
+	const double		mean = (sorted.empty() ? 0.0 : total / static_cast<double>(sorted.size()));
+	out << "\t" << std::left << std::setw(10) << name << std::right
+		<< " mean " << std::setw(7) << mean
+		<< " p50 " << std::setw(7) << percentile(sorted, 0.5)
+		<< " p95 " << std::setw(7) << percentile(sorted, 0.95)
+		<< " max " << std::setw(7) << (sorted.empty() ? 0.0 : sorted.back())
+		<< " ms over " << sorted.size() << " frames" << std::endl;
+}
+
+} // namespace cs
@@ -0,0 +1,64 @@
+#ifndef CS_FRAMETIMES_H_
+#define CS_FRAMETIMES_H_
+
+#include <chrono>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cinder/gl/gl.h>
+
+namespace cs {
+
+/**
+ * @class cs::FrameTimes
+ * @brief Collect per-frame timings over a run and summarize them.
+ * @description CPU times come from the caller. GPU times come from a small
+ * ring of timer queries around each frame's GL commands; a query is only
+ * read once it's a few frames old, so measuring doesn't stall the GPU.
+ * Queries can't nest, so nothing else can time the GPU during a frame.
+ * ES has no timer queries, so there the GPU is reported as n/a.
+ */
+class FrameTimes {
+public:
+	FrameTimes();
+	~FrameTimes();
+
+	// Bracket one frame's GL commands. Main thread only.
+	void						beginGpu();
+	void						endGpu();
+	// Add one frame's CPU times, in seconds. The wall time since the
+	// previous add() is the frame interval.
+	void						add(const double update_seconds, const double draw_seconds);
+	// Time the next interval from now, leaving out whatever happened
+	// since add().
+	void						restartInterval();
+	// Read back any GPU times still in flight.
+	void						finish();
+
+	size_t						getCount() const { return mUpdate.size(); }
+	// Print the mean, median, 95th percentile and worst of each series, in ms.
+	void						print(std::ostream&) const;
+
+private:
+	FrameTimes(const FrameTimes&);
+	FrameTimes&					operator=(const FrameTimes&);
+
+	void						readGpu();
+	static void					printSeries(std::ostream&, const std::string &name, const std::vector<double>&);
+
+	// Milliseconds per frame.
+	std::vector<double>			mUpdate,
+								mDraw,
+								mInterval,
+								mGpu;
+	// When the last frame was added, for the interval between frames.
+	std::chrono::steady_clock::time_point	mLast;
+
+	std::vector<GLuint>			mQueries;
+	size_t						mIssued = 0,
+								mRead = 0;
+};
+
+} // namespace cs
+
+#endif
@@ -4,11 +4,23 @@
 #include <cinder/Surface.h>
 #include "kt/app/kt_cns.h"
 #include "kt/app/kt_environment.h"
+#include "kt/async/thread_pool.h"
 
 namespace cs {
 
 namespace { 
 const float			WHITE = 1.0f;
+
+// Check for cancellation once every chunk of particles.
+const size_t		CANCEL_CHUNK = 256;
+inline bool			cancelled(const GeneratorParams &gp, const size_t k) {
+	return (k % CANCEL_CHUNK) == 0 && gp.cancelled();
+}
+
+// Targets per chunk when mapping an image in parallel.
+const size_t		TARGET_GRAIN = 1024;
+// Image rows per chunk when sampling.
+const size_t		SAMPLE_ROW_GRAIN = 16;
 }
 
 /**
@@ -22,13 +34,28 @@ void GeneratorParams::setTo(const kt::Cns &cns) {
 /**
  * @class cs::Generator
  */
+void Generator::prepare(const GeneratorParams &p, const size_t count) {
+	onPrepare(p, count);
+	mPrepared = true;
+}
+
 void Generator::update(const GeneratorParams &p, ParticleList &list) {
 //	std::cout << "generator " << typeid(*this).name() << std::endl;
 
 	list.mTransitionDuration = 2.0;
 	list.mHoldDuration = 0.2;
 
+	if (!mPrepared) onPrepare(p, list.size());
+	mPrepared = false;
+	if (p.cancelled()) return;
+	// Colors continue from the last frame, and go back to white unless
+	// the generator picks something else.
+	for (auto& p : list) {
+		p.mStartColor = p.mEndColor;
+		p.mEndColor = RGBA8_WHITE;
+	}
 	onUpdate(p, list);
+	if (p.cancelled()) return;
 
 	// Assign 20 random accent generators.
 	for (auto& p : list) p.mHasAccents = false;
@@ -65,6 +92,15 @@ glm::vec3 Generator::nextPt(const kt::math::Cube &cube) {
 /**
  * @class cs::RandomGenerator
  */
+void RandomGenerator::onPrepare(const GeneratorParams &gp, const size_t count) {
+	if (mMode != Mode::kClosest) return;
+
+	mClosestPts.resize(count);
+	for (auto& p : mClosestPts) {
+		p = nextPt(gp.mWorldBounds);
+	}
+}
+
 void RandomGenerator::onUpdate(const GeneratorParams &gp, ParticleList &list) {
 	list.mHoldDuration = 0.0;
 
@@ -102,15 +138,16 @@ void RandomGenerator::onUpdateAnywhere(const GeneratorParams &gp, ParticleList &
 
 void RandomGenerator::onUpdateClosest(const GeneratorParams &gp, ParticleList &list) {
 	if (list.empty()) return;
-	mClosestPts.resize(list.size());
-
-	for (auto& p : mClosestPts) {
-		p = nextPt(gp.mWorldBounds);
+	// Prepared points should match, but top up in case the list changed size.
+	while (mClosestPts.size() < list.size()) {
+		mClosestPts.push_back(nextPt(gp.mWorldBounds));
 	}
 
 	// Each point picks its closest, eliminating as it goes. Not the best possible
 	// results, but hopefully decent for a reasonable performance trade off.
+	size_t						k = 0;
 	for (auto& p : list) {
+		if (cancelled(gp, k++)) return;
 		kt::math::Bezier3f&		c(p.mCurve);
 
 		// Continue from the previous end point
@@ -151,7 +188,7 @@ glm::vec3 RandomGenerator::popClosest(const glm::vec3 &pt, PtList &list) const {
 /**
  * @class cs::PolyLineGenerator
  */
-void PolyLineGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
+void PolyLineGenerator::onPrepare(const GeneratorParams &gp, const size_t) {
 	// Make up a line for now
 	if (mLine.getPoints().empty()) {
 		mLine.push_back(glm::vec3(gp.mWorldBounds.atUnit(glm::vec3(0.0f, 0.0f, 0.9f))));
@@ -165,8 +202,12 @@ void PolyLineGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
 		line.push_back(glm::vec3(gp.mWorldBounds.atUnit(glm::vec3(0.0f, 1.0f, 0.9f))));
 		mLines.push_back(line);
 	}
+}
 
+void PolyLineGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
+	size_t						k = 0;
 	for (auto& p : l) {
+		if (cancelled(gp, k++)) return;
 		// Alpha
 		p.mStartAlpha = p.mEndAlpha;
 		p.mEndAlpha = 1.0f;		
@@ -187,10 +228,14 @@ void PolyLineGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
 /**
  * @class cs::RandomLineGenerator
  */
-void RandomLineGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
+void RandomLineGenerator::onPrepare(const GeneratorParams &gp, const size_t) {
 	nextLines(gp.mWorldBounds);
+}
 
+void RandomLineGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
+	size_t						k = 0;
 	for (auto& p : l) {
+		if (cancelled(gp, k++)) return;
 		// Alpha
 		p.mStartAlpha = p.mEndAlpha;
 		p.mEndAlpha = 1.0f;		
@@ -228,16 +273,52 @@ void RandomLineGenerator::nextLines(const kt::math::Cube &cube) {
 /**
  * @class cs::ImageGenerator
  */
-void ImageGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
-//l.mHoldDuration = 10.0;
-//	ci::Surface8u		s(ci::loadImage(kt::env::expand("$(DATA)/images/Eagle 1.jpg")));
-	ci::Surface8u		s(ci::loadImage(kt::env::expand("$(DATA)/images/vox_siren.png")));
+std::once_flag						ImageGenerator::SAMPLES_ONCE;
+kt::async::Task<ImageGenerator::Samples>	ImageGenerator::SAMPLES;
+
+ImageGenerator::ImageGenerator()
+		: mSamples(sharedSamples()) {
+}
 
-	const int			total_src_size  = s.getWidth() * s.getHeight();
-	const float			src_w(static_cast<float>(s.getWidth())),
-						src_h(static_cast<float>(s.getHeight()));
+kt::async::Task<ImageGenerator::Samples> ImageGenerator::sharedSamples() {
+	std::call_once(SAMPLES_ONCE, []() {
+		auto&				pool(kt::async::PoolExecutor::shared());
+		SAMPLES = kt::async::run(pool, []() {
+//			return ci::Surface8u(ci::loadImage(kt::env::expand("$(DATA)/images/Eagle 1.jpg")));
+			return ci::Surface8u(ci::loadImage(kt::env::expand("$(DATA)/images/vox_siren.png")));
+		}).then(pool, [](ci::Surface8u &s) {
+			Samples			ans;
+			ans.mWidth = s.getWidth();
+			ans.mHeight = s.getHeight();
+			ans.mDarkness.resize(static_cast<size_t>(ans.mWidth) * ans.mHeight);
+			ans.mColor.resize(ans.mDarkness.size());
+			float*			dst = ans.mDarkness.data();
+			uint32_t*		dst_clr = ans.mColor.data();
+			const int32_t	w = ans.mWidth;
+			kt::async::parallel_for(0, static_cast<size_t>(ans.mHeight), SAMPLE_ROW_GRAIN, [&](const size_t b, const size_t e) {
+				for (int32_t y=static_cast<int32_t>(b); y<static_cast<int32_t>(e); ++y) {
+					for (int32_t x=0; x<w; ++x) {
+						const auto	clr = s.getPixel(glm::ivec2(x, y));
+						dst[y*w + x] = 1.0f - (static_cast<float>(clr.r + clr.g + clr.b) / (255.0f * 3.0f));
+						dst_clr[y*w + x] = to_rgba8(clr.r, clr.g, clr.b);
+					}
+				}
+			});
+			return ans;
+		});
+	});
+	return SAMPLES;
+}
+
+void ImageGenerator::onPrepare(const GeneratorParams &gp, const size_t count) {
+	// Only waits if prepare beats the decode.
+	const Samples&		s(mSamples.get());
+	if (s.mWidth < 1 || s.mHeight < 1) return;
+
+	const float			src_w(static_cast<float>(s.mWidth)),
+						src_h(static_cast<float>(s.mHeight));
 	const float			aspect = src_w / src_h;
-	const float			sqr = floorf(ci::math<float>::sqrt(static_cast<float>(l.size())));
+	const float			sqr = floorf(ci::math<float>::sqrt(static_cast<float>(count)));
 	float				w = 1.0f, h = 1.0f;
 	int32_t				rows = static_cast<int32_t>(sqr), cols = static_cast<int32_t>(sqr);
 	if (aspect >= 1.0f) {
@@ -246,32 +327,54 @@ void ImageGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
 		h = w / aspect;
 	}
 
-	int32_t				y = 0, x = 0;
+	mTargets.resize(count);
+	mTargetColors.resize(count);
+	glm::vec3*			targets = mTargets.data();
+	uint32_t*			colors = mTargetColors.data();
+	kt::async::parallel_for(0, count, TARGET_GRAIN, [&](const size_t b, const size_t e) {
+		if (gp.cancelled()) return;
+		for (size_t k=b; k<e; ++k) {
+			// Get coords
+			const int32_t			x = static_cast<int32_t>(k % cols),
+									y = static_cast<int32_t>(k / cols);
+			glm::vec2				fpt(static_cast<float>(x) / (static_cast<float>(cols-1)),
+										static_cast<float>(y) / (static_cast<float>(rows-1)));
+			glm::ivec2				src_pt(static_cast<int32_t>(fpt.x*src_w), static_cast<int32_t>(fpt.y*src_h));
+			if (src_pt.x < 0) src_pt.x = 0;
+			else if (src_pt.x >= s.mWidth) src_pt.x = s.mWidth-1;
+			if (src_pt.y < 0) src_pt.y = 0;
+			else if (src_pt.y >= s.mHeight) src_pt.y = s.mHeight-1;
+
+			// Src value
+			const size_t			src_idx = static_cast<size_t>(src_pt.y*s.mWidth + src_pt.x);
+			const float				v = s.mDarkness[src_idx];
+
+			targets[k] = gp.mExactWorldBounds.atUnit(glm::vec3(fpt.x, fpt.y, v));
+			colors[k] = s.mColor[src_idx];
+		}
+	});
+}
+
+void ImageGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
+//l.mHoldDuration = 10.0;
+	if (mTargets.size() < l.size()) onPrepare(gp, l.size());
+	if (mTargets.size() < l.size()) return;
+
+	const glm::vec3*	target = mTargets.data();
+	const uint32_t*		color = mTargetColors.data();
 	for (auto& p : l) {
 		// Alpha
 		p.mStartAlpha = p.mEndAlpha;
 		p.mEndAlpha = 1.0f;		
 
-		// Curve
-		// Get coords
-		glm::vec2				fpt(static_cast<float>(x) / (static_cast<float>(cols-1)),
-									static_cast<float>(y) / (static_cast<float>(rows-1)));
-		glm::ivec2				src_pt(static_cast<int32_t>(fpt.x*src_w), static_cast<int32_t>(fpt.y*src_h));
-		if (src_pt.x < 0) src_pt.x = 0;
-		else if (src_pt.x >= s.getWidth()) src_pt.x = s.getWidth()-1;
-		if (src_pt.y < 0) src_pt.y = 0;
-		else if (src_pt.y >= s.getHeight()) src_pt.y = s.getHeight()-1;
-
-		// Src value
-		const auto				clr = s.getPixel(src_pt);
-		const float				v = 1.0f - (static_cast<float>(clr.r + clr.g + clr.b) / (255.0f * 3.0f));
-
-		glm::vec3				pt = gp.mExactWorldBounds.atUnit(glm::vec3(fpt.x, fpt.y, v));
+		// Color of the pixel it lands on
+		p.mEndColor = *color++;
 
+		// Curve
 		// Continue from the previous end point
 		kt::math::Bezier3f&		c(p.mCurve);
 		c.mP0 = p.mCurve.mP3;
-		c.mP3 = pt;
+		c.mP3 = *target++;
 
 		c.mP1 = glm::vec3(0, 0, -5);
 		c.mP2 = glm::vec3(0, 0, -5);
@@ -279,11 +382,6 @@ void ImageGenerator::onUpdate(const GeneratorParams &gp, ParticleList &l) {
 		// Blur things out a little on the blue, because why not, even though you
 		// really can't tell.
 //		p.mEndAlpha = glm::mix(0.1f, 1.0f, static_cast<float>(clr.b)/255.0f);
-
-		if (++x >= cols) {
-			x = 0;
-			++y;
-		}
 	}
 }
 
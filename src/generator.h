@@ -1,8 +1,11 @@
 #ifndef CS_GENERATOR_H_
 #define CS_GENERATOR_H_
 
+#include <mutex>
 #include <cinder/PolyLine.h>
 #include <cinder/Rand.h>
+#include "kt/async/cancel_token.h"
+#include "kt/async/task.h"
 #include "kt/math/geometry.h"
 #include "particle_list.h"
 
@@ -21,8 +24,13 @@ public:
 
 	void				setTo(const kt::Cns&);
 
+	// Generators poll this between chunks of work, and stop early
+	// if the generation has gone stale.
+	bool				cancelled() const { return mCancel.cancelled(); }
+
 	kt::math::Cube		mWorldBounds,
 						mExactWorldBounds;
+	kt::async::CancelToken	mCancel;
 };
 
 /**
@@ -33,11 +41,19 @@ class Generator {
 public:
 	virtual ~Generator() { }
 
+	// Do any work that doesn't depend on the particles, for a list of count
+	// particles. This can run while the previous frame is still being generated.
+	// Optional -- if it isn't called, update() will do it.
+	void				prepare(const GeneratorParams&, const size_t count);
 	// Update the curve. Ideally, treat the curve's endpoint
-	// as the particle's current position.
+	// as the particle's current position. Each particle's color starts
+	// at its last end color and ends white, unless onUpdate() sets
+	// mEndColor. If the params are cancelled the list is left partially
+	// updated.
 	void				update(const GeneratorParams&, ParticleList&);
 
 protected:
+	virtual void		onPrepare(const GeneratorParams&, const size_t count) { }
 	virtual void		onUpdate(const GeneratorParams&, ParticleList&) = 0;
 
 	// Random utility -- answer a random point somewhere in the cube.
@@ -46,6 +62,9 @@ protected:
 	Generator() { }
 
 	cinder::Rand		mRand;
+
+private:
+	bool				mPrepared = false;
 };
 
 /**
@@ -57,6 +76,7 @@ public:
 	enum class Mode		{ kAnywhere, kClosest };
 	RandomGenerator(const Mode m = Mode::kClosest) : mMode(m) { }
 
+	void				onPrepare(const GeneratorParams&, const size_t count) override;
 	void				onUpdate(const GeneratorParams&, ParticleList&) override;
 
 private:
@@ -80,6 +100,7 @@ public:
 	PolyLineGenerator() { }
 	PolyLineGenerator(const ci::PolyLine3f &line) : mLine(line) { }
 
+	void				onPrepare(const GeneratorParams&, const size_t count) override;
 	void				onUpdate(const GeneratorParams&, ParticleList&) override;
 
 private:
@@ -95,6 +116,7 @@ class RandomLineGenerator : public Generator {
 public:
 	RandomLineGenerator() { }
 
+	void				onPrepare(const GeneratorParams&, const size_t count) override;
 	void				onUpdate(const GeneratorParams&, ParticleList&) override;
 
 private:
@@ -110,9 +132,33 @@ private:
  */
 class ImageGenerator : public Generator {
 public:
-	ImageGenerator() { }
+	ImageGenerator();
 
+	void				onPrepare(const GeneratorParams&, const size_t count) override;
 	void				onUpdate(const GeneratorParams&, ParticleList&) override;
+
+private:
+	// The source image, reduced to the darkness (0-1) and packed
+	// color of each pixel.
+	class Samples {
+	public:
+		Samples() { }
+
+		int32_t			mWidth = 0,
+						mHeight = 0;
+		std::vector<float> mDarkness;
+		std::vector<uint32_t> mColor;
+	};
+	// Decoded and sampled on the pool, once per run, and shared by every
+	// image generator; ready long before the first prepare.
+	static kt::async::Task<Samples>	sharedSamples();
+	static std::once_flag	SAMPLES_ONCE;
+	static kt::async::Task<Samples>	SAMPLES;
+
+	kt::async::Task<Samples> mSamples;
+	// The point in the image each particle is attracted to, and its color.
+	std::vector<glm::vec3> mTargets;
+	std::vector<uint32_t> mTargetColors;
 };
 
 } // namespace cs
@@ -0,0 +1,83 @@
+#include "image_compare.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include "kt/async/thread_pool.h"
+
+namespace cs {
+
+namespace {
+// Rows per chunk when comparing in parallel.
+const size_t		ROW_GRAIN = 32;
+
+// Running totals for a range of rows.
+class Totals {
+public:
+	Totals() { }
+
+	double			mAbs = 0.0,
+					mSquared = 0.0;
+	int				mMax = 0;
+	size_t			mChanged = 0;
+};
+}
+
+/**
+ * @class cs::ImageDiff
+ */
+const double			ImageDiff::MIN_PSNR = 30.0;
+
+/**
+ * @func compare_images
+ */
+ImageDiff				compare_images(const ci::Surface8u &a, const ci::Surface8u &b, const int threshold) {
+	if (a.getWidth() != b.getWidth() || a.getHeight() != b.getHeight()
+			|| a.hasAlpha() != b.hasAlpha() || a.getPixelInc() != b.getPixelInc()) {
+		throw std::runtime_error("compare_images on images of different sizes");
+	}
+	ImageDiff				ans;
+	const size_t			w = static_cast<size_t>(a.getWidth()),
+							h = static_cast<size_t>(a.getHeight());
+	const size_t			inc = a.getPixelInc(),
+							channels = (a.hasAlpha() ? 4 : 3);
+	if (w < 1 || h < 1) return ans;
+
+	const Totals			t = kt::async::parallel_reduce(0, h, ROW_GRAIN, Totals(), [&](const size_t begin, const size_t end) {
+		Totals				t;
+		for (size_t y=begin; y<end; ++y) {
+			const uint8_t*	pa = a.getData() + y * a.getRowBytes();
+			const uint8_t*	pb = b.getData() + y * b.getRowBytes();
+			for (size_t x=0; x<w; ++x, pa+=inc, pb+=inc) {
+				int			worst = 0;
+				for (size_t c=0; c<channels; ++c) {
+					const int	d = std::abs(static_cast<int>(pa[c]) - static_cast<int>(pb[c]));
+					t.mAbs += d;
+					t.mSquared += static_cast<double>(d * d);
+					if (d > worst) worst = d;
+				}
+				if (worst > t.mMax) t.mMax = worst;
+				if (worst > threshold) ++t.mChanged;
+			}
+		}
+		return t;
+	}, [](const Totals &x, const Totals &y) {
+		Totals				t;
+		t.mAbs = x.mAbs + y.mAbs;
+		t.mSquared = x.mSquared + y.mSquared;
+		t.mMax = (x.mMax > y.mMax ? x.mMax : y.mMax);
+		t.mChanged = x.mChanged + y.mChanged;
+		return t;
+	});
+
+	const double			values = static_cast<double>(w * h * channels);
+	ans.mMeanAbs = t.mAbs / values;
+	ans.mRms = std::sqrt(t.mSquared / values);
+	ans.mPsnr = (ans.mRms > 0.0 ? 20.0 * std::log10(255.0 / ans.mRms) : std::numeric_limits<double>::infinity());
+	ans.mMax = t.mMax;
+	ans.mChanged = static_cast<double>(t.mChanged) / static_cast<double>(w * h);
+	return ans;
+}
+
+} // namespace cs
@@ -0,0 +1,38 @@
+#ifndef CS_IMAGECOMPARE_H_
+#define CS_IMAGECOMPARE_H_
+
+#include <cinder/Surface.h>
+
+namespace cs {
+
+/**
+ * @class cs::ImageDiff
+ * @brief How far apart two images are, in channel values (0-255).
+ */
+class ImageDiff {
+public:
+	ImageDiff() { }
+
+	// The lowest PSNR, in dB, that still counts as the same picture.
+	static const double	MIN_PSNR;
+	bool				passed() const { return mPsnr >= MIN_PSNR; }
+
+	double				mMeanAbs = 0.0,
+						mRms = 0.0,
+	// Peak signal to noise, in dB. Infinite if the images match.
+						mPsnr = 0.0;
+	int					mMax = 0;
+	// Fraction of pixels with any channel off by more than the threshold.
+	double				mChanged = 0.0;
+};
+
+/**
+ * @func compare_images
+ * @brief Compare every channel of two images of the same size and layout.
+ * Throws if they don't match.
+ */
+ImageDiff				compare_images(const ci::Surface8u&, const ci::Surface8u&, const int threshold = 2);
+
+} // namespace cs
+
+#endif
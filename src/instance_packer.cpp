@@ -0,0 +1,233 @@
+#include "instance_packer.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CS_INSTANCE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace cs {
+
+namespace {
+const float			UNORM16 = 65535.0f,
+					UNORM8 = 255.0f;
+// The faintest alpha that doesn't round to 0.
+const float			MIN_ALPHA = 0.5f / UNORM8;
+
+inline float		unit_clamp(const float v) {
+	// Written so a NaN from empty bounds lands on 0.
+	return (v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f);
+}
+
+// Answer the id of the k'th particle: from the ids if there are any,
+// otherwise from its place.
+inline uint32_t		id_at(const char *id_bytes, const size_t id_stride, const uint32_t first_id, const size_t k) {
+	if (id_bytes) return *reinterpret_cast<const uint32_t*>(id_bytes + k * id_stride);
+	return first_id + static_cast<uint32_t>(k);
+}
+
+inline float		safe_span(const float v) {
+	return (v != 0.0f ? v : 1.0f);
+}
+
+#ifdef CS_INSTANCE_SSE2
+// The packer's constants, loaded once.
+class Lanes {
+public:
+	__m128			mLo, mLoSlope, mSpan, mSpanSlope, mScale, mHalf, mZero, mOne,
+					mVisibleLo, mVisibleLoSlope, mVisibleHi, mVisibleHiSlope;
+	__m128i			mBias, mFlip;
+	float			mZLo, mZInv;
+};
+
+// Answer the unit depth of the position at p.
+inline __m128		unit_z(const float *p, const Lanes &l) {
+	return _mm_set1_ps(unit_clamp((p[2] - l.mZLo) * l.mZInv));
+}
+
+// Answer the quantized lanes, biased down by 32768 so they survive
+// the signed saturation in _mm_packs_epi32.
+inline __m128i		quantize(const __m128 v, const __m128 uz, const Lanes &l) {
+	const __m128	lo = _mm_add_ps(l.mLo, _mm_mul_ps(l.mLoSlope, uz));
+	const __m128	span = _mm_add_ps(l.mSpan, _mm_mul_ps(l.mSpanSlope, uz));
+	__m128			u = _mm_div_ps(_mm_sub_ps(v, lo), span);
+	u = _mm_min_ps(_mm_max_ps(u, l.mZero), l.mOne);
+	const __m128i	q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(u, l.mScale), l.mHalf));
+	return _mm_sub_epi32(q, l.mBias);
+}
+
+// Answer 1 if every lane is in its visible range, otherwise 0.
+inline size_t		visible(const __m128 v, const __m128 uz, const Lanes &l) {
+	const __m128	lo = _mm_add_ps(l.mVisibleLo, _mm_mul_ps(l.mVisibleLoSlope, uz)),
+					hi = _mm_add_ps(l.mVisibleHi, _mm_mul_ps(l.mVisibleHiSlope, uz));
+	const __m128	in = _mm_and_ps(_mm_cmpge_ps(v, lo), _mm_cmple_ps(v, hi));
+	return (_mm_movemask_ps(in) == 0xf ? 1 : 0);
+}
+#endif
+}
+
+/**
+ * @class cs::InstancePacker
+ */
+InstancePacker::InstancePacker() {
+	for (int k=0; k<4; ++k) {
+		mLo[k] = mLoSlope[k] = mSpanSlope[k] = 0.0f;
+		mSpan[k] = 1.0f;
+		mVisibleLo[k] = -FLT_MAX;
+		mVisibleHi[k] = FLT_MAX;
+		mVisibleLoSlope[k] = mVisibleHiSlope[k] = 0.0f;
+	}
+}
+
+InstancePacker::InstancePacker(const kt::math::Cube &b)
+		: mBounds(b) {
+	const glm::vec3&	far_ll(b.mFarLL),
+						far_ur(b.mFarUR),
+						near_ll(b.mNearLL),
+						near_ur(b.mNearUR);
+	// x and y narrow from the far slice to the near one.
+	for (int k=0; k<2; ++k) {
+		mLo[k] = far_ll[k];
+		mLoSlope[k] = near_ll[k] - far_ll[k];
+		mSpan[k] = safe_span(far_ur[k] - far_ll[k]);
+		mSpanSlope[k] = (near_ur[k] - near_ll[k]) - (far_ur[k] - far_ll[k]);
+	}
+	mLo[2] = far_ll.z;
+	mSpan[2] = safe_span(near_ll.z - far_ll.z);
+	mLo[3] = 0.0f;
+	mSpan[3] = 1.0f;
+	mLoSlope[2] = mLoSlope[3] = mSpanSlope[2] = mSpanSlope[3] = 0.0f;
+	for (int k=0; k<4; ++k) {
+		mVisibleLo[k] = -FLT_MAX;
+		mVisibleHi[k] = FLT_MAX;
+		mVisibleLoSlope[k] = mVisibleHiSlope[k] = 0.0f;
+	}
+}
+
+void InstancePacker::setVisible(const kt::math::Cube &v, const float margin) {
+	mCulling = true;
+	// The visible edges move linearly from the far slice to the near one.
+	// Either axis might run backwards.
+	for (int k=0; k<2; ++k) {
+		const float		far_lo = std::min(v.mFarLL[k], v.mFarUR[k]) - margin,
+						far_hi = std::max(v.mFarLL[k], v.mFarUR[k]) + margin,
+						near_lo = std::min(v.mNearLL[k], v.mNearUR[k]) - margin,
+						near_hi = std::max(v.mNearLL[k], v.mNearUR[k]) + margin;
+		mVisibleLo[k] = far_lo;
+		mVisibleLoSlope[k] = near_lo - far_lo;
+		mVisibleHi[k] = far_hi;
+		mVisibleHiSlope[k] = near_hi - far_hi;
+	}
+	mVisibleLo[2] = -FLT_MAX;
+	mVisibleHi[2] = FLT_MAX;
+	mVisibleLo[3] = MIN_ALPHA;
+	mVisibleHi[3] = FLT_MAX;
+	mVisibleLoSlope[2] = mVisibleLoSlope[3] = mVisibleHiSlope[2] = mVisibleHiSlope[3] = 0.0f;
+}
+
+size_t InstancePacker::pack(const float *src, const size_t stride, const size_t count, Instance *dst) const {
+	return pack(src, stride, nullptr, 0, count, dst, nullptr);
+}
+
+size_t InstancePacker::pack(const float *src, const size_t stride,
+							const uint32_t *colors, const size_t color_stride,
+							const size_t count, Instance *dst, uint32_t *color_dst,
+							uint32_t *id_dst, const uint32_t first_id,
+							const uint32_t *ids, const size_t id_stride) const {
+	const char*			bytes = reinterpret_cast<const char*>(src);
+	const char*			color_bytes = reinterpret_cast<const char*>(colors);
+	const char*			id_bytes = reinterpret_cast<const char*>(ids);
+	if (!colors) color_dst = nullptr;
+	size_t				k = 0,
+						n = 0;
+#ifdef CS_INSTANCE_SSE2
+	Lanes				l;
+	l.mLo = _mm_loadu_ps(mLo);
+	l.mLoSlope = _mm_loadu_ps(mLoSlope);
+	l.mSpan = _mm_loadu_ps(mSpan);
+	l.mSpanSlope = _mm_loadu_ps(mSpanSlope);
+	l.mScale = _mm_setr_ps(UNORM16, UNORM16, UNORM16, UNORM8);
+	l.mHalf = _mm_set1_ps(0.5f);
+	l.mZero = _mm_setzero_ps();
+	l.mOne = _mm_set1_ps(1.0f);
+	l.mVisibleLo = _mm_loadu_ps(mVisibleLo);
+	l.mVisibleLoSlope = _mm_loadu_ps(mVisibleLoSlope);
+	l.mVisibleHi = _mm_loadu_ps(mVisibleHi);
+	l.mVisibleHiSlope = _mm_loadu_ps(mVisibleHiSlope);
+	l.mBias = _mm_set1_epi32(32768);
+	l.mFlip = _mm_set1_epi16(static_cast<short>(0x8000));
+	l.mZLo = mLo[2];
+	l.mZInv = 1.0f / mSpan[2];
+
+	if (!mCulling) {
+		// Two instances per store. The pad lane is the alpha lane's high byte,
+		// which is always 0.
+		for (; k+2<=count; k+=2) {
+			const float*	pa = reinterpret_cast<const float*>(bytes + k * stride);
+			const float*	pb = reinterpret_cast<const float*>(bytes + (k+1) * stride);
+			const __m128i	a = quantize(_mm_loadu_ps(pa), unit_z(pa, l), l),
+							b = quantize(_mm_loadu_ps(pb), unit_z(pb, l), l);
+			const __m128i	packed = _mm_xor_si128(_mm_packs_epi32(a, b), l.mFlip);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + k), packed);
+		}
+		if (color_dst) {
+			for (size_t i=0; i<k; ++i) color_dst[i] = *reinterpret_cast<const uint32_t*>(color_bytes + i * color_stride);
+		}
+		if (id_dst) {
+			for (size_t i=0; i<k; ++i) id_dst[i] = id_at(id_bytes, id_stride, first_id, i);
+		}
+		n = k;
+	} else {
+		// Compact without branching: every instance is written to the next
+		// free slot, which only moves on if it's visible.
+		for (; k<count; ++k) {
+			const float*	p = reinterpret_cast<const float*>(bytes + k * stride);
+			const __m128	v = _mm_loadu_ps(p),
+							uz = unit_z(p, l);
+			const __m128i	q = quantize(v, uz, l);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + n), _mm_xor_si128(_mm_packs_epi32(q, q), l.mFlip));
+			if (color_dst) color_dst[n] = *reinterpret_cast<const uint32_t*>(color_bytes + k * color_stride);
+			if (id_dst) id_dst[n] = id_at(id_bytes, id_stride, first_id, k);
+			n += visible(v, uz, l);
+		}
+	}
+#endif
+	for (; k<count; ++k) {
+		const bool		vis = packScalar(reinterpret_cast<const float*>(bytes + k * stride), dst[n]);
+		if (color_dst) color_dst[n] = *reinterpret_cast<const uint32_t*>(color_bytes + k * color_stride);
+		if (id_dst) id_dst[n] = id_at(id_bytes, id_stride, first_id, k);
+		if (vis || !mCulling) ++n;
+	}
+	return n;
+}
+
+glm::vec3 InstancePacker::unpack(const Instance &i) const {
+	const float			ux = static_cast<float>(i.mX) / UNORM16,
+						uy = static_cast<float>(i.mY) / UNORM16,
+						uz = static_cast<float>(i.mZ) / UNORM16;
+	return glm::vec3(	mLo[0] + mLoSlope[0] * uz + ux * (mSpan[0] + mSpanSlope[0] * uz),
+						mLo[1] + mLoSlope[1] * uz + uy * (mSpan[1] + mSpanSlope[1] * uz),
+						mLo[2] + uz * mSpan[2]);
+}
+
+bool InstancePacker::packScalar(const float *p, Instance &dst) const {
+	const float			uz = unit_clamp((p[2] - mLo[2]) / mSpan[2]);
+	float				q[4];
+	bool				visible = true;
+	for (int k=0; k<4; ++k) {
+		const float		lo = mLo[k] + mLoSlope[k] * uz,
+						span = mSpan[k] + mSpanSlope[k] * uz;
+		visible = visible && p[k] >= mVisibleLo[k] + mVisibleLoSlope[k] * uz && p[k] <= mVisibleHi[k] + mVisibleHiSlope[k] * uz;
+		q[k] = unit_clamp((p[k] - lo) / span) * (k < 3 ? UNORM16 : UNORM8) + 0.5f;
+	}
+	dst.mX = static_cast<uint16_t>(q[0]);
+	dst.mY = static_cast<uint16_t>(q[1]);
+	dst.mZ = static_cast<uint16_t>(q[2]);
+	dst.mAlpha = static_cast<uint8_t>(q[3]);
+	dst.mSize = 0;
+	return visible;
+}
+
+} // namespace cs
@@ -0,0 +1,90 @@
+#ifndef CS_INSTANCEPACKER_H_
+#define CS_INSTANCEPACKER_H_
+
+#include <cstdint>
+#include "kt/math/geometry.h"
+
+namespace cs {
+
+/**
+ * @class cs::Instance
+ * @brief A particle packed for drawing, in 8 bytes. The vertex shader reads
+ * it as an ivec2: x and y in the first int, z, alpha and size in the second.
+ */
+class Instance {
+public:
+	uint16_t			mX, mY, mZ;
+	uint8_t				mAlpha;
+	// Across, in particles, for an impostor standing in for a cluster of
+	// them. 0 is a single particle.
+	uint8_t				mSize;
+};
+
+/**
+ * @class cs::InstancePacker
+ * @brief Quantize positions and alphas into instances.
+ * @description Positions are stored as unorm16 within the frustum of the
+ * world bounds: z across the depth, then x and y across the slice at that
+ * depth, the same as kt::math::Cube::toUnit(). Every depth gets the full
+ * 65536 steps across the screen, so the error is the same fraction of a
+ * pixel near and far. With the world bounds 1.5 screens wide, a step is
+ * under 0.05 pixels at 1080p and under 0.1 at 4K, and the error is half
+ * that. Anything outside the bounds is clamped to them. Alpha is unorm8.
+ *
+ * With setVisible(), packing also culls: anything off screen, or too faint
+ * to round to a visible alpha, is dropped, and the rest are compacted to
+ * the front of the output. The test falls out of the quantize, so it
+ * costs next to nothing.
+ */
+class InstancePacker {
+public:
+	InstancePacker();
+	explicit InstancePacker(const kt::math::Cube&);
+
+	// Cull anything outside visible, grown by margin world units across x
+	// and y. Visible is normally the exact bounds, inside the packing bounds.
+	void				setVisible(const kt::math::Cube &visible, const float margin);
+	bool				isCulling() const { return mCulling; }
+
+	// src points to the x of a position, followed by y, z and alpha. Each
+	// next one is stride bytes further on. Answer the number of instances
+	// written, which is count unless culling. Uses SSE2 where available.
+	size_t				pack(const float *src, const size_t stride, const size_t count, Instance *dst) const;
+	// The same, and the colors of the instances that survive are copied
+	// to color_dst. If id_dst isn't null, each survivor's id is written
+	// there: read from ids, id_stride bytes apart, or without ids, its index
+	// in src plus first_id.
+	size_t				pack(	const float *src, const size_t stride,
+								const uint32_t *colors, const size_t color_stride,
+								const size_t count, Instance *dst, uint32_t *color_dst,
+								uint32_t *id_dst = nullptr, const uint32_t first_id = 0,
+								const uint32_t *ids = nullptr, const size_t id_stride = 0) const;
+	// Answer where an instance draws. The vertex shader does the same.
+	glm::vec3			unpack(const Instance&) const;
+
+	const kt::math::Cube&	getBounds() const { return mBounds; }
+
+private:
+	// Answer true if the instance is visible.
+	bool				packScalar(const float *src, Instance &dst) const;
+
+	kt::math::Cube		mBounds;
+	// Per lane (x, y, z, alpha), at unit depth uz the lane's range starts at
+	// mLo + mLoSlope * uz and spans mSpan + mSpanSlope * uz.
+	float				mLo[4],
+						mLoSlope[4],
+						mSpan[4],
+						mSpanSlope[4];
+	// Per lane, the range that's visible, the same way: at unit depth uz
+	// it's from mVisibleLo + mVisibleLoSlope * uz to mVisibleHi +
+	// mVisibleHiSlope * uz. z is never culled, and alpha only at the bottom.
+	bool				mCulling = false;
+	float				mVisibleLo[4],
+						mVisibleLoSlope[4],
+						mVisibleHi[4],
+						mVisibleHiSlope[4];
+};
+
+} // namespace cs
+
+#endif
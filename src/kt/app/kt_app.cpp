@@ -3,6 +3,7 @@
 #include <cinder/gl/gl.h>
 #include <cinder/gl/scoped.h>
 #include "kt_environment.h"
+#include "../async/task.h"
 
 namespace kt {
 
@@ -34,6 +35,8 @@ App::App()
 }
 
 void App::update() {
+	// Finish anything handed back to the main thread.
+	kt::async::MainExecutor::shared().drain();
 	onUpdate();
 }
 
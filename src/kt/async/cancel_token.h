@@ -0,0 +1,64 @@
+#ifndef KT_ASYNC_CANCELTOKEN_H_
+#define KT_ASYNC_CANCELTOKEN_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace kt {
+namespace async {
+class CancelSource;
+
+/**
+ * @class kt::async::CancelToken
+ * @brief A cheap, copyable check for whether work has been cancelled. Long-running
+ * work should poll cancelled() between chunks and bail out when it's true.
+ */
+class CancelToken {
+public:
+	CancelToken() { }
+
+	bool							cancelled() const;
+
+private:
+	friend class CancelSource;
+	const std::atomic<uint32_t>*	mSource = nullptr;
+	uint32_t						mGeneration = 0;
+};
+
+/**
+ * @class kt::async::CancelSource
+ * @brief Issue tokens. Cancelling cancels every token issued so far; tokens
+ * issued afterwards are live. The source must outlive its tokens.
+ */
+class CancelSource {
+public:
+	CancelSource() { mGeneration.store(0); }
+
+	CancelToken						token() const;
+	void							cancel() { mGeneration.fetch_add(1); }
+
+private:
+	CancelSource(const CancelSource&);
+	CancelSource&					operator=(const CancelSource&);
+
+	std::atomic<uint32_t>			mGeneration;
+};
+
+/**
+ * IMPLEMENTATION
+ */
+inline bool CancelToken::cancelled() const {
+	return mSource && mSource->load(std::memory_order_relaxed) != mGeneration;
+}
+
+inline CancelToken CancelSource::token() const {
+	CancelToken		t;
+	t.mSource = &mGeneration;
+	t.mGeneration = mGeneration.load();
+	return t;
+}
+
+} // namespace async
+} // namespace kt
+
+#endif
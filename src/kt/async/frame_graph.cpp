@@ -0,0 +1,192 @@
+#include "frame_graph.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include "thread_pool.h"
+
+namespace kt {
+namespace async {
+
+namespace {
+// Weight of the newest frame in the smoothed timings.
+const double			AVERAGE_WEIGHT = 0.1;
+
+bool					intersects(const std::vector<int> &a, const std::vector<int> &b) {
+	for (const auto& r : a) {
+		if (std::find(b.begin(), b.end(), r) != b.end()) return true;
+	}
+	return false;
+}
+
+double					smooth(const double average, const double value, const bool first) {
+	if (first) return value;
+	return average + (value - average) * AVERAGE_WEIGHT;
+}
+}
+
+/**
+ * @class kt::async::FrameGraph
+ */
+FrameGraph::FrameGraph()
+		: mPool(ThreadPool::shared()) {
+}
+
+FrameGraph::FrameGraph(ThreadPool &pool)
+		: mPool(pool) {
+}
+
+size_t FrameGraph::add(	const std::string &name,
+						const std::vector<int> &reads, const std::vector<int> &writes,
+						const Thread thread, const std::function<void(void)> &fn) {
+	// Running nodes point into the list, so don't add during run().
+	std::lock_guard<std::mutex>		lock(mMutex);
+	Node							n;
+	n.mIndex = mNodes.size();
+	n.mThread = thread;
+	n.mReads = reads;
+	n.mWrites = writes;
+	n.mFn = fn;
+	// Wait for anyone earlier who writes what I touch, or reads what I write.
+	for (const auto& prev : mNodes) {
+		if (intersects(prev.mWrites, reads) || intersects(prev.mWrites, writes) || intersects(prev.mReads, writes)) {
+			n.mDependencies.push_back(prev.mIndex);
+		}
+	}
+	mNodes.push_back(n);
+	for (auto& node : mNodes) node.mGraph = this;
+
+	Timing							t;
+	t.mName = name;
+	t.mThread = thread;
+	mTimings.push_back(t);
+	return n.mIndex;
+}
+
+void FrameGraph::run() {
+	const bool						first = (mFrameSeconds <= 0.0);
+	std::unique_lock<std::mutex>	lock(mMutex);
+	mFrameStart = std::chrono::steady_clock::now();
+	mStates.assign(mNodes.size(), State::kWaiting);
+	mTickets.assign(mNodes.size(), nullptr);
+	mDone = 0;
+	mError = nullptr;
+
+	while (mDone < mNodes.size()) {
+		// Pool nodes go to the pool while there's anything else for me to
+		// do. The last one ready I run myself rather than wait for it.
+		Node						*main = nullptr,
+									*any = nullptr;
+		size_t						any_count = 0;
+		for (auto& n : mNodes) {
+			if (mStates[n.mIndex] != State::kWaiting || !isReady(n)) continue;
+			if (n.mThread == Thread::kMain) {
+				if (!main) main = &n;
+			} else {
+				if (!any) any = &n;
+				++any_count;
+			}
+		}
+		if (!main && !any) {
+			// Nothing's ready. Rather than wait on a pool that's busy with
+			// something else, run a node it hasn't started yet.
+			Node*					queued = nullptr;
+			for (auto& t : mTickets) {
+				if (t && t->take()) {
+					queued = &t->mNode;
+					break;
+				}
+			}
+			if (!queued) {
+				mCondition.wait(lock);
+				continue;
+			}
+			lock.unlock();
+			execute(*queued);
+			lock.lock();
+			continue;
+		}
+
+		Node*						next = (any ? any : main);
+		mStates[next->mIndex] = State::kRunning;
+		if (next->mThread == Thread::kMain || (any && !main && any_count == 1)) {
+			lock.unlock();
+			execute(*next);
+		} else {
+			std::shared_ptr<Ticket>	ticket(new Ticket(*next));
+			mTickets[next->mIndex] = ticket;
+			lock.unlock();
+			mPool.submit([ticket]() { runOnPool(ticket); });
+		}
+		lock.lock();
+	}
+
+	// Tickets the pool hasn't got to yet are already taken; let them go.
+	mTickets.clear();
+	const std::chrono::duration<double>	frame(std::chrono::steady_clock::now() - mFrameStart);
+	mFrameSeconds = frame.count();
+	mAverageFrameSeconds = smooth(mAverageFrameSeconds, mFrameSeconds, first);
+	for (auto& t : mTimings) t.mAverage = smooth(t.mAverage, t.mSeconds, first);
+
+	if (mError) {
+		std::exception_ptr			error(mError);
+		mError = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void FrameGraph::print(std::ostream &out) const {
+	const std::ios::fmtflags		flags(out.flags());
+	out << std::fixed << std::setprecision(2);
+	out << "frame " << (mFrameSeconds * 1000.0) << " ms (avg " << (mAverageFrameSeconds * 1000.0) << ")" << std::endl;
+	for (const auto& t : mTimings) {
+		out << "\t" << std::left << std::setw(12) << t.mName << std::right
+			<< " at " << std::setw(6) << (t.mStart * 1000.0)
+			<< " took " << std::setw(6) << (t.mSeconds * 1000.0)
+			<< " avg " << std::setw(6) << (t.mAverage * 1000.0)
+			<< (t.mThread == Thread::kMain ? " main" : "") << std::endl;
+	}
+	out.flags(flags);
+}
+
+void FrameGraph::runOnPool(const std::shared_ptr<Ticket> &ticket) {
+	// If the caller took the node back, the graph might be gone; only the
+	// ticket is safe to touch.
+	if (!ticket->take()) return;
+	Node&							n(ticket->mNode);
+	n.mGraph->execute(n);
+}
+
+void FrameGraph::execute(Node &n) {
+	const auto						start = std::chrono::steady_clock::now();
+	std::exception_ptr				error;
+	try {
+		n.mFn();
+	} catch (...) {
+		error = std::current_exception();
+	}
+	const auto						end = std::chrono::steady_clock::now();
+
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		Timing&						t(mTimings[n.mIndex]);
+		t.mStart = std::chrono::duration<double>(start - mFrameStart).count();
+		t.mSeconds = std::chrono::duration<double>(end - start).count();
+		if (error && !mError) mError = error;
+		mStates[n.mIndex] = State::kDone;
+		++mDone;
+		// Notify while locked; once the last node is done, run() can return
+		// and the graph can go away.
+		mCondition.notify_all();
+	}
+}
+
+bool FrameGraph::isReady(const Node &n) const {
+	for (const auto& d : n.mDependencies) {
+		if (mStates[d] != State::kDone) return false;
+	}
+	return true;
+}
+
+} // namespace async
+} // namespace kt
@@ -0,0 +1,130 @@
+#ifndef KT_ASYNC_FRAMEGRAPH_H_
+#define KT_ASYNC_FRAMEGRAPH_H_
+
+/**
+ * FRAME-GRAPH
+ * The stages of a frame, and the data each stage reads and writes. Stages
+ * that don't share data run concurrently on the thread pool; stages that
+ * must be on the main thread (anything touching GL) run on the thread that
+ * calls run(), interleaved with pool stages as their inputs become ready.
+ * When the caller has nothing of its own to do, it runs a ready pool stage
+ * itself, or takes back one the pool hasn't started, instead of waiting.
+ * Stages too small to be worth a trip to the pool should just be main.
+ * Stages that do share data run in the order they were added.
+ *
+ * Resources are whatever ints the client likes, usually an enum:
+ *		graph.add("pack", {kParticles}, {kStaging}, FrameGraph::Thread::kAny, [this]() { ... });
+ *		graph.add("draw", {kStaging}, {kScreen}, FrameGraph::Thread::kMain, [this]() { ... });
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kt {
+namespace async {
+class ThreadPool;
+
+/**
+ * @class kt::async::FrameGraph
+ */
+class FrameGraph {
+public:
+	FrameGraph();
+	explicit FrameGraph(ThreadPool&);
+
+	enum class Thread				{ kAny, kMain };
+
+	// Add a stage. Answer its index.
+	size_t							add(const std::string &name,
+										const std::vector<int> &reads, const std::vector<int> &writes,
+										const Thread, const std::function<void(void)>&);
+
+	// Run every stage once, blocking until they're all done. The first
+	// exception thrown by a stage is rethrown here, after every stage is done.
+	void							run();
+
+	// How long each stage took. Start is relative to the start of the frame.
+	class Timing {
+	public:
+		Timing() { }
+
+		std::string					mName;
+		Thread						mThread = Thread::kAny;
+		double						mStart = 0.0,
+									mSeconds = 0.0,
+		// Smoothed over recent frames.
+									mAverage = 0.0;
+	};
+	const std::vector<Timing>&		getTimings() const { return mTimings; }
+	// Wall time of the last frame, and smoothed over recent frames.
+	double							getFrameSeconds() const { return mFrameSeconds; }
+	double							getAverageFrameSeconds() const { return mAverageFrameSeconds; }
+	// One line per stage.
+	void							print(std::ostream&) const;
+
+private:
+	FrameGraph(const FrameGraph&);
+	FrameGraph&						operator=(const FrameGraph&);
+
+	class Node {
+	public:
+		Node() { }
+
+		FrameGraph*					mGraph = nullptr;
+		size_t						mIndex = 0;
+		Thread						mThread = Thread::kAny;
+		std::vector<int>			mReads,
+									mWrites;
+		std::function<void(void)>	mFn;
+		// Earlier nodes I have to wait for.
+		std::vector<size_t>			mDependencies;
+	};
+	enum class State				{ kWaiting, kRunning, kDone };
+
+	// A node handed to the pool. Whoever takes it first runs it: a pool
+	// worker, or the caller if the pool is slow to get to it. The pool
+	// holds a reference, so a ticket taken back can outlive the frame.
+	class Ticket {
+	public:
+		explicit Ticket(Node &n) : mNode(n) { mTaken.store(false); }
+
+		bool						take() { return !mTaken.exchange(true); }
+
+		Node&						mNode;
+		std::atomic<bool>			mTaken;
+	};
+
+	static void						runOnPool(const std::shared_ptr<Ticket>&);
+	void							execute(Node&);
+	// Answer true if every dependency of the node is done. Call with the mutex held.
+	bool							isReady(const Node&) const;
+
+	ThreadPool&						mPool;
+	std::vector<Node>				mNodes;
+	std::vector<Timing>				mTimings;
+	double							mFrameSeconds = 0.0,
+									mAverageFrameSeconds = 0.0;
+
+	// Per frame.
+	std::mutex						mMutex;
+	std::condition_variable			mCondition;
+	std::vector<State>				mStates;
+	std::vector<std::shared_ptr<Ticket>>	mTickets;
+	size_t							mDone = 0;
+	std::exception_ptr				mError;
+	std::chrono::steady_clock::time_point
+									mFrameStart;
+};
+
+} // namespace async
+} // namespace kt
+
+#endif
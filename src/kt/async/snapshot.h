@@ -0,0 +1,148 @@
+#ifndef KT_ASYNC_SNAPSHOT_H_
+#define KT_ASYNC_SNAPSHOT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kt {
+namespace async {
+
+/**
+ * @class kt::async::Snapshot
+ * @brief Publish immutable, versioned copies of a value (read-copy-update). A
+ * writer publishes a new copy whenever the value changes; readers acquire a
+ * reference to whichever copy is current, and keep reading it for as long
+ * as they hold it, regardless of later publishes. Reading through a reference
+ * is just a pointer dereference, and acquiring one never blocks.
+ *
+ * One thread writes: publish() and reclaim(). Any thread can acquire and
+ * release. The snapshot must outlive every reference.
+ */
+template <typename T>
+class Snapshot {
+private:
+	class Node {
+	public:
+		Node(const T &v, const uint64_t version) : mValue(v), mVersion(version) { mRefs.store(0); }
+
+		const T					mValue;
+		const uint64_t			mVersion;
+		std::atomic<size_t>		mRefs;
+	};
+
+public:
+	/**
+	 * @class kt::async::Snapshot::Ref
+	 * @brief A reference to one version. Cheap to copy.
+	 */
+	class Ref {
+	public:
+		Ref() { }
+		Ref(const Ref &r) : mNode(r.mNode) { if (mNode) mNode->mRefs.fetch_add(1); }
+		~Ref() { release(); }
+
+		Ref&					operator=(const Ref &r) {
+			if (r.mNode) r.mNode->mRefs.fetch_add(1);
+			release();
+			mNode = r.mNode;
+			return *this;
+		}
+
+		explicit operator bool() const { return mNode != nullptr; }
+		const T&				operator*() const { return mNode->mValue; }
+		const T*				operator->() const { return &mNode->mValue; }
+		// Starts at 1 and counts up with every publish.
+		uint64_t				version() const { return mNode ? mNode->mVersion : 0; }
+
+		void					release() {
+			if (mNode) mNode->mRefs.fetch_sub(1);
+			mNode = nullptr;
+		}
+
+	private:
+		friend class Snapshot<T>;
+		// Adopt a reference.
+		explicit Ref(Node *n) : mNode(n) { }
+
+		Node*					mNode = nullptr;
+	};
+
+	explicit Snapshot(const T &initial = T());
+	~Snapshot();
+
+	Ref							acquire() const;
+	// Answer the version of the new copy. Old copies are freed once no
+	// one holds them.
+	uint64_t					publish(const T&);
+	// Free any old copies no one holds. publish() does this too.
+	void						reclaim();
+
+	uint64_t					getVersion() const { return mVersion; }
+	// Old copies still held by someone.
+	size_t						getRetiredCount() const { return mRetired.size(); }
+
+private:
+	Snapshot(const Snapshot&);
+	Snapshot&					operator=(const Snapshot&);
+
+	std::atomic<Node*>			mCurrent;
+	// Readers between loading the current node and taking a reference to it.
+	// Nothing retired is freed while anyone's in that window.
+	mutable std::atomic<size_t>	mAcquiring;
+	// Writer only.
+	uint64_t					mVersion = 0;
+	std::vector<Node*>			mRetired;
+};
+
+/**
+ * IMPLEMENTATION - Snapshot
+ */
+template <typename T>
+Snapshot<T>::Snapshot(const T &initial) {
+	mAcquiring.store(0);
+	mCurrent.store(new Node(initial, ++mVersion));
+}
+
+template <typename T>
+Snapshot<T>::~Snapshot() {
+	for (auto n : mRetired) delete n;
+	delete mCurrent.load();
+}
+
+template <typename T>
+typename Snapshot<T>::Ref Snapshot<T>::acquire() const {
+	mAcquiring.fetch_add(1);
+	Node*						n = mCurrent.load();
+	n->mRefs.fetch_add(1);
+	mAcquiring.fetch_sub(1);
+	return Ref(n);
+}
+
+template <typename T>
+uint64_t Snapshot<T>::publish(const T &v) {
+	Node*						n = new Node(v, ++mVersion);
+	mRetired.push_back(mCurrent.exchange(n));
+	reclaim();
+	return n->mVersion;
+}
+
+template <typename T>
+void Snapshot<T>::reclaim() {
+	// A reader that got in before the publish might be about to take a
+	// reference to what's now retired. Anyone arriving later sees the new copy.
+	if (mRetired.empty() || mAcquiring.load() > 0) return;
+	size_t						kept = 0;
+	for (size_t k=0; k<mRetired.size(); ++k) {
+		Node*					n = mRetired[k];
+		if (n->mRefs.load() > 0) mRetired[kept++] = n;
+		else delete n;
+	}
+	mRetired.resize(kept);
+}
+
+} // namespace async
+} // namespace kt
+
+#endif
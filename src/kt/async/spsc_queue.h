@@ -0,0 +1,98 @@
+#ifndef KT_ASYNC_SPSCQUEUE_H_
+#define KT_ASYNC_SPSCQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace kt {
+namespace async {
+
+/**
+ * @class kt::async::SpscQueue
+ * @brief A bounded, lock-free queue for exactly one producer thread and one
+ * consumer thread. push() is only called by the producer, pop() only by the
+ * consumer. Popped slots are left moved-from, so T must be move-assignable
+ * and default-constructible.
+ */
+template <typename T>
+class SpscQueue {
+public:
+	// Capacity is rounded up to a power of two.
+	explicit SpscQueue(const size_t capacity);
+
+	// Answer false if the queue is full; item is untouched.
+	bool								push(T &&item);
+	// Answer false if the queue is empty.
+	bool								pop(T &out);
+	// Safe from either side, but only a snapshot.
+	bool								empty() const;
+
+private:
+	SpscQueue();
+	SpscQueue(const SpscQueue<T>&);
+	SpscQueue&							operator=(const SpscQueue<T>&);
+
+	static const size_t					CACHE_LINE = 64;
+
+	std::vector<T>						mSlots;
+	size_t								mMask = 0;
+	// The consumer owns the head, the producer owns the tail. Each keeps
+	// them on their own cache line, along with a cached copy of the other
+	// side's index, so they only touch each other's line when they must.
+	char								mPad0[CACHE_LINE];
+	std::atomic<size_t>					mHead;
+	size_t								mTailCache = 0;
+	char								mPad1[CACHE_LINE];
+	std::atomic<size_t>					mTail;
+	size_t								mHeadCache = 0;
+	char								mPad2[CACHE_LINE];
+};
+
+/**
+ * IMPLEMENTATION - SpscQueue
+ */
+template <typename T>
+SpscQueue<T>::SpscQueue(const size_t capacity) {
+	size_t								size = 2;
+	while (size < capacity) size <<= 1;
+	mSlots.resize(size);
+	mMask = size - 1;
+	mHead.store(0);
+	mTail.store(0);
+}
+
+template <typename T>
+bool SpscQueue<T>::push(T &&item) {
+	const size_t						tail = mTail.load(std::memory_order_relaxed);
+	if (tail - mHeadCache > mMask) {
+		mHeadCache = mHead.load(std::memory_order_acquire);
+		if (tail - mHeadCache > mMask) return false;
+	}
+	mSlots[tail & mMask] = std::move(item);
+	mTail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T>
+bool SpscQueue<T>::pop(T &out) {
+	const size_t						head = mHead.load(std::memory_order_relaxed);
+	if (head == mTailCache) {
+		mTailCache = mTail.load(std::memory_order_acquire);
+		if (head == mTailCache) return false;
+	}
+	out = std::move(mSlots[head & mMask]);
+	mHead.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T>
+bool SpscQueue<T>::empty() const {
+	return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+}
+
+} // namespace async
+} // namespace kt
+
+#endif
@@ -0,0 +1,135 @@
+#include "task.h"
+
+#include "thread_pool.h"
+
+namespace kt {
+namespace async {
+
+namespace {
+std::once_flag					MAIN_ONCE,
+								POOL_ONCE;
+std::unique_ptr<MainExecutor>	MAIN;
+std::unique_ptr<PoolExecutor>	POOL;
+}
+
+/**
+ * @class kt::async::detail::TaskStateBase
+ */
+namespace detail {
+
+void TaskStateBase::setError(const std::exception_ptr &e) {
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		mError = e;
+	}
+	complete();
+}
+
+bool TaskStateBase::ready() const {
+	std::lock_guard<std::mutex>		lock(mMutex);
+	return mDone;
+}
+
+void TaskStateBase::wait() const {
+	std::unique_lock<std::mutex>	lock(mMutex);
+	mCondition.wait(lock, [this]() { return mDone; });
+}
+
+void TaskStateBase::setContinuation(Work *w, Executor *e) {
+	if (!w) return;
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		if (mContinuation) throw std::runtime_error("Task can only be continued once");
+		if (!mDone) {
+			mContinuation = w;
+			mExecutor = e;
+			return;
+		}
+	}
+	// Already done, so go now.
+	if (e) e->post(w);
+	else w->execute();
+}
+
+void TaskStateBase::waitForValue() const {
+	wait();
+	if (mError) std::rethrow_exception(mError);
+}
+
+void TaskStateBase::complete() {
+	Work*							w = nullptr;
+	Executor*						e = nullptr;
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		mDone = true;
+		w = mContinuation;
+		e = mExecutor;
+	}
+	mCondition.notify_all();
+	if (!w) return;
+	if (e) e->post(w);
+	else w->execute();
+}
+
+} // namespace detail
+
+/**
+ * @class kt::async::MainExecutor
+ */
+MainExecutor::MainExecutor() {
+	mHead.store(nullptr);
+}
+
+MainExecutor& MainExecutor::shared() {
+	std::call_once(MAIN_ONCE, []() { MAIN.reset(new MainExecutor()); });
+	return *MAIN;
+}
+
+void MainExecutor::post(Work *w) {
+	if (!w) return;
+	Work*						head = mHead.load();
+	do {
+		w->mNext = head;
+	} while (!mHead.compare_exchange_weak(head, w));
+}
+
+void MainExecutor::drain() {
+	Work*						w = mHead.exchange(nullptr);
+	if (!w) return;
+
+	// Posted newest first, so reverse.
+	Work*						fifo = nullptr;
+	while (w) {
+		Work*					next = w->mNext;
+		w->mNext = fifo;
+		fifo = w;
+		w = next;
+	}
+	while (fifo) {
+		Work*					next = fifo->mNext;
+		try {
+			fifo->execute();
+		} catch (std::exception const&) {
+		}
+		fifo = next;
+	}
+}
+
+/**
+ * @class kt::async::PoolExecutor
+ */
+PoolExecutor::PoolExecutor(ThreadPool &pool)
+		: mPool(pool) {
+}
+
+PoolExecutor& PoolExecutor::shared() {
+	std::call_once(POOL_ONCE, []() { POOL.reset(new PoolExecutor(ThreadPool::shared())); });
+	return *POOL;
+}
+
+void PoolExecutor::post(Work *w) {
+	if (w) mPool.submit([w]() { w->execute(); });
+}
+
+} // namespace async
+} // namespace kt
@@ -0,0 +1,559 @@
+#ifndef KT_ASYNC_TASK_H_
+#define KT_ASYNC_TASK_H_
+
+/**
+ * TASKS and EXECUTORS
+ * A Task is the eventual result of some work. Work runs on an explicit executor --
+ * the main thread or the pool -- and tasks chain into pipelines, each step running
+ * wherever it asks to:
+ *		std::weak_ptr<View>	view(shared_from_this());
+ *		kt::async::run(PoolExecutor::shared(), [](){ return decode(); })
+ *			.then(PoolExecutor::shared(), [](Image &i){ return sample(i); })
+ *			.then(MainExecutor::shared(), [view](Samples &s){ if (auto v = view.lock()) v->assign(s); });
+ * A step can run after whoever started the chain is gone, so steps hold what they
+ * touch by weak_ptr (or check a CancelToken), never by a raw this.
+ * Each step is a single intrusive node that is both the work and the state of the
+ * next task, so there's one allocation per step and no std::function.
+ *
+ * With C++20 coroutines available, tasks can also be awaited, and a coroutine
+ * can return a Task:
+ *		Task<int> f() { Image i = co_await decode_task.on(PoolExecutor::shared()); ... }
+ *
+ * Work without a result is a Task<void>; its continuations take no argument.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define KT_ASYNC_COROUTINES		(1)
+#endif
+
+namespace kt {
+namespace async {
+class ThreadPool;
+
+/**
+ * @class kt::async::Work
+ * @brief An intrusive unit of work. An executor runs it exactly once; from then
+ * on it owns itself.
+ */
+class Work {
+public:
+	virtual ~Work() { }
+
+	virtual void					execute() = 0;
+
+	// Used by executors to link pending work.
+	Work*							mNext = nullptr;
+};
+
+/**
+ * @class kt::async::Executor
+ * @brief Somewhere work runs.
+ */
+class Executor {
+public:
+	virtual ~Executor() { }
+
+	// Safe from any thread.
+	virtual void					post(Work*) = 0;
+};
+
+/**
+ * @class kt::async::MainExecutor
+ * @brief Run work on the main thread, the next time it drains. The app drains
+ * at the start of every update.
+ */
+class MainExecutor : public Executor {
+public:
+	MainExecutor();
+
+	static MainExecutor&			shared();
+
+	void							post(Work*) override;
+	// Main thread only. Run everything posted before the call, in order.
+	void							drain();
+
+private:
+	MainExecutor(const MainExecutor&);
+	MainExecutor&					operator=(const MainExecutor&);
+
+	// Newest first.
+	std::atomic<Work*>				mHead;
+};
+
+/**
+ * @class kt::async::PoolExecutor
+ * @brief Run work on a thread pool.
+ */
+class PoolExecutor : public Executor {
+public:
+	explicit PoolExecutor(ThreadPool&);
+
+	// Runs on the shared pool.
+	static PoolExecutor&			shared();
+
+	void							post(Work*) override;
+
+private:
+	PoolExecutor(const PoolExecutor&);
+	PoolExecutor&					operator=(const PoolExecutor&);
+
+	ThreadPool&						mPool;
+};
+
+namespace detail {
+
+// The type fn(args...) answers. result_of is gone from C++20.
+#if defined(__cpp_lib_is_invocable)
+template <typename F, typename... Args>
+struct Result { typedef std::invoke_result_t<F, Args...> type; };
+#else
+template <typename F, typename... Args>
+struct Result { typedef typename std::result_of<F(Args...)>::type type; };
+#endif
+
+// The type a continuation of a Task<T> answers: fn(T&), or fn() for void.
+template <typename T, typename F>
+struct ThenResult { typedef typename Result<F, T&>::type type; };
+template <typename F>
+struct ThenResult<void, F> { typedef typename Result<F>::type type; };
+
+/**
+ * @class kt::async::detail::TaskStateBase
+ * @brief The shared, reference-counted state of a task, all but the value.
+ */
+class TaskStateBase {
+public:
+	TaskStateBase() { mRefs.store(1); }
+	virtual ~TaskStateBase() { }
+
+	void							addRef() { mRefs.fetch_add(1); }
+	void							release() { if (mRefs.fetch_sub(1) == 1) delete this; }
+
+	void							setError(const std::exception_ptr&);
+
+	bool							ready() const;
+	void							wait() const;
+
+	// Post the continuation to the executor once there's a result; null runs
+	// it on whichever thread finishes. Only one continuation per task.
+	void							setContinuation(Work*, Executor*);
+
+protected:
+	// Wait, then rethrow the error, if that's the result.
+	void							waitForValue() const;
+	// Call once the value is set.
+	void							complete();
+
+	mutable std::mutex				mMutex;
+
+private:
+	mutable std::condition_variable	mCondition;
+	bool							mDone = false;
+	std::exception_ptr				mError;
+	Work*							mContinuation = nullptr;
+	Executor*						mExecutor = nullptr;
+	std::atomic<size_t>				mRefs;
+};
+
+/**
+ * @class kt::async::detail::TaskState
+ * @brief A task's state, with its value.
+ */
+template <typename T>
+class TaskState : public TaskStateBase {
+public:
+	TaskState() { }
+
+	void							setValue(T&&);
+	// Wait, then answer the value or rethrow the error.
+	T&								get();
+
+private:
+	T								mValue;
+};
+
+template <>
+class TaskState<void> : public TaskStateBase {
+public:
+	TaskState() { }
+
+	void							setValue() { complete(); }
+	void							get() { waitForValue(); }
+};
+
+// Set a task to fn(args...), or fn(args...) then done for void.
+template <typename R>
+struct Fulfil {
+	template <typename F, typename... Args>
+	static void						with(TaskState<R> &s, F &fn, Args&&... args) { s.setValue(fn(std::forward<Args>(args)...)); }
+};
+template <>
+struct Fulfil<void> {
+	template <typename F, typename... Args>
+	static void						with(TaskState<void> &s, F &fn, Args&&... args) { fn(std::forward<Args>(args)...); s.setValue(); }
+};
+
+// Fulfil a task with fn(source value), or fn() for a void source.
+template <typename T>
+struct Continue {
+	template <typename R, typename F>
+	static void						with(TaskState<R> &s, F &fn, TaskState<T> &source) { Fulfil<R>::with(s, fn, source.get()); }
+};
+template <>
+struct Continue<void> {
+	template <typename R, typename F>
+	static void						with(TaskState<R> &s, F &fn, TaskState<void> &source) { source.get(); Fulfil<R>::with(s, fn); }
+};
+
+// Run fn() and hold its result.
+template <typename R, typename F>
+class RunNode : public TaskState<R>, public Work {
+public:
+	explicit RunNode(F &&fn) : mFn(std::move(fn)) { this->addRef(); }
+
+	void							execute() override;
+	// Drop the executor's reference, when no executor got the node.
+	void							abandon() { this->release(); }
+
+private:
+	F								mFn;
+};
+
+// Run fn(source value) once the source is ready, and hold its result.
+template <typename T, typename R, typename F>
+class ThenNode : public TaskState<R>, public Work {
+public:
+	ThenNode(TaskState<T> *source, F &&fn) : mSource(source), mFn(std::move(fn)) { this->addRef(); mSource->addRef(); }
+
+	void							execute() override;
+	// Drop the executor's reference, when no executor got the node.
+	void							abandon();
+
+private:
+	TaskState<T>*					mSource;
+	F								mFn;
+};
+
+// Hold a new node until it's handed to an executor, abandoning it if
+// handing it over throws.
+template <typename N>
+class HandOff {
+public:
+	explicit HandOff(N *n) : mNode(n) { }
+	~HandOff() { if (mNode) mNode->abandon(); }
+
+	N*								get() const { return mNode; }
+	// It's been handed over.
+	void							release() { mNode = nullptr; }
+
+private:
+	HandOff(const HandOff&);
+	HandOff&						operator=(const HandOff&);
+
+	N*								mNode;
+};
+
+} // namespace detail
+
+/**
+ * @class kt::async::Task
+ * @brief A handle to a result that isn't here yet. Cheap to copy.
+ */
+template <typename T>
+class Task {
+public:
+	Task() { }
+	Task(const Task&);
+	Task(Task&&);
+	~Task();
+
+	Task&							operator=(const Task&);
+	Task&							operator=(Task&&);
+
+	bool							valid() const { return mState != nullptr; }
+	bool							ready() const { return mState && mState->ready(); }
+	// Block until ready. Don't call this on the main thread for work
+	// that continues on the main thread.
+	void							wait() const;
+	// Wait, then answer the value or rethrow the error.
+	typename std::add_lvalue_reference<T>::type
+									get() const;
+
+	// Run fn(T&), or fn() for a Task<void>, on the executor once this task
+	// is ready. Each task can only be continued once.
+	template <typename F>
+	Task<typename detail::ThenResult<T, F>::type>
+									then(Executor&, F fn) const;
+
+#if defined(KT_ASYNC_COROUTINES)
+	class promise_type;
+	class Awaiter;
+	// Resume on whichever thread finishes the task.
+	Awaiter							operator co_await() const;
+	// Resume on the executor.
+	Awaiter							on(Executor&) const;
+#endif
+
+private:
+	template <typename U> friend class Task;
+	template <typename F> friend Task<typename detail::Result<F>::type> run(Executor&, F);
+
+	// Adopt a reference.
+	explicit Task(detail::TaskState<T> *s) : mState(s) { }
+
+	detail::TaskState<T>*			mState = nullptr;
+};
+
+/**
+ * @func run
+ * @brief Run fn() on the executor, answering a task for its result.
+ */
+template <typename F>
+Task<typename detail::Result<F>::type>
+									run(Executor&, F fn);
+
+/**
+ * IMPLEMENTATION - TaskState
+ */
+namespace detail {
+
+template <typename T>
+void TaskState<T>::setValue(T &&v) {
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		mValue = std::move(v);
+	}
+	complete();
+}
+
+template <typename T>
+T& TaskState<T>::get() {
+	waitForValue();
+	return mValue;
+}
+
+template <typename R, typename F>
+void RunNode<R, F>::execute() {
+	try {
+		Fulfil<R>::with(*this, mFn);
+	} catch (...) {
+		this->setError(std::current_exception());
+	}
+	// The executor's reference.
+	this->release();
+}
+
+template <typename T, typename R, typename F>
+void ThenNode<T, R, F>::execute() {
+	try {
+		Continue<T>::with(*this, mFn, *mSource);
+	} catch (...) {
+		this->setError(std::current_exception());
+	}
+	mSource->release();
+	mSource = nullptr;
+	// The executor's reference.
+	this->release();
+}
+
+template <typename T, typename R, typename F>
+void ThenNode<T, R, F>::abandon() {
+	mSource->release();
+	mSource = nullptr;
+	this->release();
+}
+
+} // namespace detail
+
+/**
+ * IMPLEMENTATION - Task
+ */
+template <typename T>
+Task<T>::Task(const Task &t)
+		: mState(t.mState) {
+	if (mState) mState->addRef();
+}
+
+template <typename T>
+Task<T>::Task(Task &&t)
+		: mState(t.mState) {
+	t.mState = nullptr;
+}
+
+template <typename T>
+Task<T>::~Task() {
+	if (mState) mState->release();
+}
+
+template <typename T>
+Task<T>& Task<T>::operator=(const Task &t) {
+	if (t.mState) t.mState->addRef();
+	if (mState) mState->release();
+	mState = t.mState;
+	return *this;
+}
+
+template <typename T>
+Task<T>& Task<T>::operator=(Task &&t) {
+	if (this != &t) {
+		if (mState) mState->release();
+		mState = t.mState;
+		t.mState = nullptr;
+	}
+	return *this;
+}
+
+template <typename T>
+void Task<T>::wait() const {
+	if (!mState) throw std::runtime_error("Task is empty");
+	mState->wait();
+}
+
+template <typename T>
+typename std::add_lvalue_reference<T>::type Task<T>::get() const {
+	if (!mState) throw std::runtime_error("Task is empty");
+	return mState->get();
+}
+
+template <typename T>
+template <typename F>
+Task<typename detail::ThenResult<T, F>::type> Task<T>::then(Executor &e, F fn) const {
+	typedef typename detail::ThenResult<T, F>::type	R;
+	if (!mState) throw std::runtime_error("Task is empty");
+	detail::HandOff<detail::ThenNode<T, R, F>>	node(new detail::ThenNode<T, R, F>(mState, std::move(fn)));
+	Task<R>							ans(node.get());
+	mState->setContinuation(node.get(), &e);
+	node.release();
+	return ans;
+}
+
+template <typename F>
+Task<typename detail::Result<F>::type> run(Executor &e, F fn) {
+	typedef typename detail::Result<F>::type		R;
+	detail::HandOff<detail::RunNode<R, F>>	node(new detail::RunNode<R, F>(std::move(fn)));
+	Task<R>							ans(node.get());
+	e.post(node.get());
+	node.release();
+	return ans;
+}
+
+#if defined(KT_ASYNC_COROUTINES)
+/**
+ * IMPLEMENTATION - coroutines
+ */
+namespace detail {
+// Resume a coroutine, wherever it's executed.
+class ResumeNode : public Work {
+public:
+	explicit ResumeNode(std::coroutine_handle<> h) : mHandle(h) { }
+
+	void							execute() override {
+		std::coroutine_handle<>		h(mHandle);
+		delete this;
+		h.resume();
+	}
+
+private:
+	std::coroutine_handle<>			mHandle;
+};
+
+// Post a coroutine's resumption, without losing it if posting throws.
+inline void							post_resume(std::coroutine_handle<> h, TaskStateBase *after, Executor *e) {
+	std::unique_ptr<Work>			w(new ResumeNode(h));
+	if (after) after->setContinuation(w.get(), e);
+	else e->post(w.get());
+	w.release();
+}
+
+// How a coroutine's co_return sets its task.
+template <typename T>
+class PromiseReturn {
+public:
+	void							return_value(T v) { mState->setValue(std::move(v)); }
+
+protected:
+	TaskState<T>*					mState = nullptr;
+};
+
+template <>
+class PromiseReturn<void> {
+public:
+	void							return_void() { mState->setValue(); }
+
+protected:
+	TaskState<void>*				mState = nullptr;
+};
+} // namespace detail
+
+// Started eagerly; the task is ready when the coroutine returns.
+template <typename T>
+class Task<T>::promise_type : public detail::PromiseReturn<T> {
+public:
+	promise_type() { this->mState = new detail::TaskState<T>(); }
+	~promise_type() { this->mState->release(); }
+
+	Task							get_return_object() { this->mState->addRef(); return Task(this->mState); }
+	std::suspend_never				initial_suspend() noexcept { return {}; }
+	std::suspend_never				final_suspend() noexcept { return {}; }
+	void							unhandled_exception() { this->mState->setError(std::current_exception()); }
+};
+
+template <typename T>
+class Task<T>::Awaiter {
+public:
+	Awaiter(const Task &t, Executor *e) : mTask(t), mExecutor(e) { }
+
+	bool							await_ready() const { return mTask.ready() && !mExecutor; }
+	void							await_suspend(std::coroutine_handle<> h) { detail::post_resume(h, mTask.mState, mExecutor); }
+	T								await_resume() { return mTask.get(); }
+
+private:
+	Task							mTask;
+	Executor*						mExecutor;
+};
+
+template <typename T>
+typename Task<T>::Awaiter Task<T>::operator co_await() const {
+	if (!mState) throw std::runtime_error("Task is empty");
+	return Awaiter(*this, nullptr);
+}
+
+template <typename T>
+typename Task<T>::Awaiter Task<T>::on(Executor &e) const {
+	if (!mState) throw std::runtime_error("Task is empty");
+	return Awaiter(*this, &e);
+}
+
+/**
+ * @func resume_on
+ * @brief co_await resume_on(executor) to continue a coroutine there.
+ */
+class ResumeOn {
+public:
+	explicit ResumeOn(Executor &e) : mExecutor(e) { }
+
+	bool							await_ready() const { return false; }
+	void							await_suspend(std::coroutine_handle<> h) { detail::post_resume(h, nullptr, &mExecutor); }
+	void							await_resume() { }
+
+private:
+	Executor&						mExecutor;
+};
+
+inline ResumeOn						resume_on(Executor &e) { return ResumeOn(e); }
+#endif
+
+} // namespace async
+} // namespace kt
+
+#endif
@@ -0,0 +1,131 @@
+#include "thread_attributes.h"
+
+#include <cinder/Cinder.h>
+
+#if defined(CINDER_MSW)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace kt {
+namespace async {
+
+namespace {
+// Linux names are limited to 16 bytes, including the terminator.
+const size_t			MAX_NAME = 15;
+}
+
+/**
+ * @class kt::async::ThreadAttributes
+ */
+#if defined(CINDER_MSW)
+
+bool ThreadAttributes::apply() const {
+	bool				ok = true;
+	HANDLE				thread = GetCurrentThread();
+
+	if (!mName.empty()) {
+		// Only on Windows 10, so look it up rather than link to it.
+		typedef HRESULT	(WINAPI *SetThreadDescriptionFn)(HANDLE, PCWSTR);
+		auto			fn = reinterpret_cast<SetThreadDescriptionFn>(
+								GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription"));
+		if (fn) {
+			const std::wstring	wide(mName.begin(), mName.end());
+			ok = SUCCEEDED(fn(thread, wide.c_str())) && ok;
+		}
+	}
+
+	if (!mCpus.empty()) {
+		DWORD_PTR		mask = 0;
+		for (const auto c : mCpus) {
+			if (c >= 0 && c < static_cast<int>(sizeof(DWORD_PTR)*8)) mask |= (static_cast<DWORD_PTR>(1) << c);
+		}
+		if (mask) ok = (SetThreadAffinityMask(thread, mask) != 0) && ok;
+	}
+
+	int					priority = THREAD_PRIORITY_NORMAL;
+	if (mPolicy == Policy::kIdle) priority = THREAD_PRIORITY_IDLE;
+	else if (mPolicy == Policy::kFifo || mPolicy == Policy::kRoundRobin) priority = THREAD_PRIORITY_TIME_CRITICAL;
+	else if (mNice >= 10) priority = THREAD_PRIORITY_LOWEST;
+	else if (mNice > 0 || mPolicy == Policy::kBatch) priority = THREAD_PRIORITY_BELOW_NORMAL;
+	else if (mNice <= -10) priority = THREAD_PRIORITY_HIGHEST;
+	else if (mNice < 0) priority = THREAD_PRIORITY_ABOVE_NORMAL;
+	if (priority != THREAD_PRIORITY_NORMAL) ok = (SetThreadPriority(thread, priority) != 0) && ok;
+
+	return ok;
+}
+
+bool lock_memory() {
+	// No equivalent to mlockall().
+	return false;
+}
+
+#else
+
+bool ThreadAttributes::apply() const {
+	bool				ok = true;
+
+	if (!mName.empty()) {
+		const std::string	name(mName.substr(0, MAX_NAME));
+#if defined(__APPLE__)
+		ok = (pthread_setname_np(name.c_str()) == 0) && ok;
+#else
+		ok = (pthread_setname_np(pthread_self(), name.c_str()) == 0) && ok;
+#endif
+	}
+
+#if defined(__linux__)
+	if (!mCpus.empty()) {
+		cpu_set_t		set;
+		CPU_ZERO(&set);
+		for (const auto c : mCpus) {
+			if (c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &set);
+		}
+		ok = (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) && ok;
+	}
+
+	if (mPolicy != Policy::kDefault) {
+		sched_param		param;
+		param.sched_priority = 0;
+		int				policy = SCHED_OTHER;
+		if (mPolicy == Policy::kBatch) policy = SCHED_BATCH;
+		else if (mPolicy == Policy::kIdle) policy = SCHED_IDLE;
+		else if (mPolicy == Policy::kFifo) policy = SCHED_FIFO;
+		else if (mPolicy == Policy::kRoundRobin) policy = SCHED_RR;
+		if (policy == SCHED_FIFO || policy == SCHED_RR) {
+			const int	lo = sched_get_priority_min(policy),
+						hi = sched_get_priority_max(policy);
+			param.sched_priority = (mPriority < lo ? lo : (mPriority > hi ? hi : mPriority));
+		}
+		ok = (pthread_setschedparam(pthread_self(), policy, &param) == 0) && ok;
+	}
+
+	// On Linux, nice is per thread when addressed by thread id.
+	if (mNice != 0) {
+		const id_t		tid = static_cast<id_t>(syscall(SYS_gettid));
+		ok = (setpriority(PRIO_PROCESS, tid, mNice) == 0) && ok;
+	}
+#endif
+
+	return ok;
+}
+
+bool lock_memory() {
+	return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+}
+
+#endif
+
+} // namespace async
+} // namespace kt
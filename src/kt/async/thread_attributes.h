@@ -0,0 +1,51 @@
+#ifndef KT_ASYNC_THREADATTRIBUTES_H_
+#define KT_ASYNC_THREADATTRIBUTES_H_
+
+#include <string>
+#include <vector>
+
+namespace kt {
+namespace async {
+
+/**
+ * @class kt::async::ThreadAttributes
+ * @brief How a thread should be scheduled. Threads apply their own attributes
+ * when they start. Everything is a request: whatever the OS refuses (usually
+ * for lack of privileges) is skipped, and the rest still applies.
+ */
+class ThreadAttributes {
+public:
+	ThreadAttributes() { }
+	// Convenience for threads that only want a name.
+	ThreadAttributes(const std::string &name) : mName(name) { }
+	ThreadAttributes(const char *name) : mName(name ? name : "") { }
+
+	// Apply to the calling thread. Answer false if anything was refused.
+	bool						apply() const;
+
+	// Shown in debuggers and top. Linux truncates to 15 characters.
+	std::string					mName;
+	// Cores the thread may run on. Empty for any.
+	std::vector<int>			mCpus;
+	// kBatch and kIdle are Linux hints for background work; kFifo and
+	// kRoundRobin are realtime and usually need privileges.
+	enum class Policy			{ kDefault, kBatch, kIdle, kFifo, kRoundRobin };
+	Policy						mPolicy = Policy::kDefault;
+	// Realtime priority, for kFifo and kRoundRobin.
+	int							mPriority = 1;
+	// -20 (most favoured) to 19 (least). 0 leaves it alone. Going below
+	// 0 usually needs privileges.
+	int							mNice = 0;
+};
+
+/**
+ * @func lock_memory
+ * @brief Lock the process's current and future memory into RAM, so hot buffers
+ * are never paged out mid-show. Answer false if refused or unsupported.
+ */
+bool							lock_memory();
+
+} // namespace async
+} // namespace kt
+
+#endif
@@ -0,0 +1,238 @@
+#include "thread_pool.h"
+
+#include <sstream>
+
+namespace kt {
+namespace async {
+
+namespace {
+// Without a grain, aim for a few chunks per thread so stealing can balance.
+const size_t			CHUNKS_PER_THREAD = 4;
+
+std::once_flag			SHARED_ONCE;
+std::unique_ptr<ThreadPool>	SHARED;
+}
+
+/**
+ * @class kt::async::ThreadPool
+ */
+ThreadPool::ThreadPool(const size_t threads) {
+	mQueued.store(0);
+	mNextQueue.store(0);
+	mStop.store(false);
+	mAttributes.mName = "pool";
+	mAttributesVersion.store(1);
+
+	size_t				count = threads;
+	if (count < 1) {
+		const size_t	hw = std::thread::hardware_concurrency();
+		count = (hw > 1 ? hw - 1 : 0);
+	}
+	// One queue per worker, plus one for callers outside the pool.
+	for (size_t k=0; k<=count; ++k) mQueues.push_back(std::unique_ptr<Queue>(new Queue()));
+	for (size_t k=0; k<count; ++k) mWorkers.push_back(std::thread([this, k](){loop(k);}));
+}
+
+ThreadPool::~ThreadPool() {
+	try {
+		mStop.store(true);
+		{
+			std::lock_guard<std::mutex>	lock(mWakeMutex);
+		}
+		mWakeCondition.notify_all();
+		for (auto& t : mWorkers) t.join();
+	} catch (std::exception const&) {
+	}
+}
+
+ThreadPool& ThreadPool::shared() {
+	std::call_once(SHARED_ONCE, []() { SHARED.reset(new ThreadPool()); });
+	return *SHARED;
+}
+
+void ThreadPool::setAttributes(const ThreadAttributes &a) {
+	{
+		std::lock_guard<std::mutex>	lock(mAttributesMutex);
+		mAttributes = a;
+	}
+	mAttributesVersion.fetch_add(1);
+	wake();
+}
+
+size_t ThreadPool::grainFor(const size_t count, const size_t grain) const {
+	if (grain > 0) return grain;
+	const size_t		chunks = getConcurrency() * CHUNKS_PER_THREAD;
+	const size_t		ans = (count + chunks - 1) / chunks;
+	return (ans > 0 ? ans : 1);
+}
+
+void ThreadPool::run(	const size_t begin, const size_t end, const size_t grain,
+						RangeFn fn, const void *ctx) {
+	if (end <= begin || !fn) return;
+	const size_t		chunk = grainFor(end-begin, grain);
+
+	// Not worth distributing.
+	if (mWorkers.empty() || end - begin <= chunk) {
+		fn(ctx, begin, end);
+		return;
+	}
+
+	Group				group;
+	const size_t		chunks = (end - begin + chunk - 1) / chunk;
+	group.mPending.store(chunks);
+
+	// Deal the chunks out across the queues.
+	size_t				q = mNextQueue.fetch_add(1) % mQueues.size();
+	for (size_t b=begin; b<end; b+=chunk) {
+		Task			t;
+		t.mFn = fn;
+		t.mCtx = ctx;
+		t.mBegin = b;
+		t.mEnd = (end - b > chunk ? b + chunk : end);
+		t.mGroup = &group;
+		{
+			std::lock_guard<std::mutex>	lock(mQueues[q]->mMutex);
+			mQueues[q]->mTasks.push_back(t);
+		}
+		q = (q + 1) % mQueues.size();
+	}
+	mQueued.fetch_add(chunks);
+	wake();
+
+	// Help with my own chunks only; anything else could be long. Once
+	// none are left to take, the rest are running, so wait for them.
+	Task				t;
+	while (stealFrom(&group, q, t)) execute(t);
+	{
+		std::unique_lock<std::mutex>	lock(group.mDoneMutex);
+		group.mDoneCondition.wait(lock, [&group]() { return group.mPending.load() == 0; });
+	}
+
+	if (group.mError) std::rethrow_exception(group.mError);
+}
+
+void ThreadPool::submit(std::function<void(void)> fn) {
+	if (!fn) return;
+	if (mWorkers.empty()) {
+		try {
+			fn();
+		} catch (std::exception const&) {
+		}
+		return;
+	}
+
+	Task				t;
+	t.mSubmitted = std::move(fn);
+	const size_t		q = mNextQueue.fetch_add(1) % mQueues.size();
+	{
+		std::lock_guard<std::mutex>	lock(mQueues[q]->mMutex);
+		mQueues[q]->mTasks.push_back(std::move(t));
+	}
+	mQueued.fetch_add(1);
+	wake();
+}
+
+void ThreadPool::loop(const size_t index) {
+	Task				t;
+	size_t				version = 0;
+	while (!mStop.load()) {
+		if (version != mAttributesVersion.load()) {
+			ThreadAttributes	a;
+			{
+				std::lock_guard<std::mutex>	lock(mAttributesMutex);
+				a = mAttributes;
+				version = mAttributesVersion.load();
+			}
+			std::stringstream	name;
+			name << a.mName << " " << index;
+			a.mName = name.str();
+			a.apply();
+		}
+		if (pop(index, t)) {
+			execute(t);
+			continue;
+		}
+		std::unique_lock<std::mutex>	lock(mWakeMutex);
+		mWakeCondition.wait(lock, [this, version]() {
+			return mStop.load() || mQueued.load() > 0 || mAttributesVersion.load() != version;
+		});
+	}
+}
+
+bool ThreadPool::pop(const size_t index, Task &out) {
+	Queue&				q(*mQueues[index]);
+	{
+		std::lock_guard<std::mutex>	lock(q.mMutex);
+		if (!q.mTasks.empty()) {
+			out = std::move(q.mTasks.back());
+			q.mTasks.pop_back();
+			return true;
+		}
+	}
+	return steal(index + 1, out);
+}
+
+bool ThreadPool::steal(const size_t start, Task &out) {
+	if (mQueued.load() < 1) return false;
+	for (size_t k=0; k<mQueues.size(); ++k) {
+		Queue&			q(*mQueues[(start + k) % mQueues.size()]);
+		std::lock_guard<std::mutex>	lock(q.mMutex);
+		if (!q.mTasks.empty()) {
+			out = std::move(q.mTasks.front());
+			q.mTasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ThreadPool::stealFrom(const Group *group, const size_t start, Task &out) {
+	if (mQueued.load() < 1) return false;
+	for (size_t k=0; k<mQueues.size(); ++k) {
+		Queue&			q(*mQueues[(start + k) % mQueues.size()]);
+		std::lock_guard<std::mutex>	lock(q.mMutex);
+		for (auto it=q.mTasks.begin(), end=q.mTasks.end(); it != end; ++it) {
+			if (it->mGroup != group) continue;
+			out = *it;
+			q.mTasks.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::execute(Task &t) {
+	mQueued.fetch_sub(1);
+	if (!t.mGroup) {
+		// Released as soon as it's run, not when the task is next reused.
+		std::function<void(void)>	fn(std::move(t.mSubmitted));
+		t.mSubmitted = nullptr;
+		try {
+			fn();
+		} catch (...) {
+		}
+		return;
+	}
+
+	try {
+		t.mFn(t.mCtx, t.mBegin, t.mEnd);
+	} catch (...) {
+		std::lock_guard<std::mutex>	lock(t.mGroup->mErrorMutex);
+		if (!t.mGroup->mError) t.mGroup->mError = std::current_exception();
+	}
+	// Last thing: once pending hits zero the group can vanish. Signal
+	// while locked, so the caller can't return until I'm done with it.
+	Group&				group(*t.mGroup);
+	std::lock_guard<std::mutex>	lock(group.mDoneMutex);
+	if (group.mPending.fetch_sub(1) == 1) group.mDoneCondition.notify_all();
+}
+
+void ThreadPool::wake() {
+	{
+		std::lock_guard<std::mutex>	lock(mWakeMutex);
+	}
+	mWakeCondition.notify_all();
+}
+
+} // namespace async
+} // namespace kt
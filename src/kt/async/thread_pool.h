@@ -0,0 +1,235 @@
+#ifndef KT_ASYNC_THREADPOOL_H_
+#define KT_ASYNC_THREADPOOL_H_
+
+/**
+ * THREAD-POOL
+ * A shared pool for data-parallel loops. Work is split into chunks of a range,
+ * spread across per-worker deques; idle workers steal from each other, and the
+ * calling thread runs its own loop's chunks until there are none left to take,
+ * then sleeps until the rest are done. It never picks up other work, so a
+ * loop on the main thread can't end up running someone's long submit(). Loops
+ * can nest without deadlocking, since every loop's caller can run all of it.
+ * Everyone should use the shared() pool so the machine isn't oversubscribed.
+ *
+ * Bodies take a half-open index range, so the inner loop stays tight:
+ *		kt::async::parallel_for(0, list.size(), 1024, [&](const size_t b, const size_t e) {
+ *			for (size_t k=b; k<e; ++k) ...
+ *		});
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "thread_attributes.h"
+
+namespace kt {
+namespace async {
+
+/**
+ * @class kt::async::ThreadPool
+ */
+class ThreadPool {
+public:
+	// A thread count of 0 uses one less than the hardware threads,
+	// since the caller always helps.
+	explicit ThreadPool(const size_t threads = 0);
+	~ThreadPool();
+
+	// The pool everyone should share. Created on first use.
+	static ThreadPool&				shared();
+
+	// Apply to every worker, at any time; workers pick them up the next
+	// time they wake. Each is named after the attributes' name and its index.
+	void							setAttributes(const ThreadAttributes&);
+
+	// Number of threads that work on a loop, including the caller.
+	size_t							getConcurrency() const { return mWorkers.size() + 1; }
+
+	// Run fn(ctx, b, e) across [begin, end) in chunks of grain and wait for
+	// all of them. Grain 0 picks one for the pool size. The first exception
+	// thrown by a chunk is rethrown here, after every chunk is finished.
+	typedef void					(*RangeFn)(const void *ctx, const size_t begin, const size_t end);
+	void							run(	const size_t begin, const size_t end, const size_t grain,
+											RangeFn, const void *ctx);
+
+	// Queue fn to run on a worker and return immediately. Exceptions are
+	// swallowed. Without workers it runs right here. The pool owns fn, so
+	// whatever it holds is released when it's run, or when the pool is
+	// destroyed with it still queued.
+	void							submit(std::function<void(void)> fn);
+
+	// Answer the chunk size run() will use.
+	size_t							grainFor(const size_t count, const size_t grain) const;
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool&						operator=(const ThreadPool&);
+
+	class Group;
+	class Task {
+	public:
+		Task() { }
+
+		RangeFn						mFn = nullptr;
+		const void*					mCtx = nullptr;
+		size_t						mBegin = 0,
+									mEnd = 0;
+		// Null for submitted tasks, which run mSubmitted instead.
+		Group*						mGroup = nullptr;
+		std::function<void(void)>	mSubmitted;
+	};
+
+	// Every chunk of one run() call.
+	class Group {
+	public:
+		Group() { mPending.store(0); }
+
+		std::atomic<size_t>			mPending;
+		std::mutex					mErrorMutex;
+		std::exception_ptr			mError;
+		// Signalled when pending hits zero.
+		std::mutex					mDoneMutex;
+		std::condition_variable		mDoneCondition;
+	};
+
+	class Queue {
+	public:
+		Queue() { }
+
+		std::mutex					mMutex;
+		std::deque<Task>			mTasks;
+	};
+
+	void							loop(const size_t index);
+	// Pop my own newest task, or steal someone else's oldest.
+	bool							pop(const size_t index, Task&);
+	bool							steal(const size_t start, Task&);
+	// Take any queued chunk of group.
+	bool							stealFrom(const Group*, const size_t start, Task&);
+	void							execute(Task&);
+	void							wake();
+
+	std::vector<std::unique_ptr<Queue>>	mQueues;
+	std::vector<std::thread>		mWorkers;
+	std::atomic<size_t>				mQueued;
+	std::atomic<size_t>				mNextQueue;
+	std::atomic_bool				mStop;
+	std::mutex						mWakeMutex;
+	std::condition_variable			mWakeCondition;
+
+	std::mutex						mAttributesMutex;
+	ThreadAttributes				mAttributes;
+	std::atomic<size_t>				mAttributesVersion;
+};
+
+/**
+ * @func parallel_for
+ * @brief Run fn(begin, end) over chunks of the range, blocking until done.
+ */
+template <typename F>
+void								parallel_for(	const size_t begin, const size_t end, const size_t grain,
+													const F &fn, ThreadPool &pool = ThreadPool::shared());
+
+/**
+ * @func parallel_reduce
+ * @brief Reduce each chunk with map(begin, end), then fold the chunk results
+ * in order with combine(a, b), starting from identity. The result doesn't
+ * depend on how chunks were scheduled.
+ */
+template <typename T, typename Map, typename Combine>
+T									parallel_reduce(const size_t begin, const size_t end, const size_t grain,
+													const T &identity, const Map &map, const Combine &combine,
+													ThreadPool &pool = ThreadPool::shared());
+
+/**
+ * @func parallel_exclusive_scan
+ * @brief out[k] = init op in[0] op ... op in[k-1]. Input and output are random
+ * access and may be the same range. op must be associative.
+ */
+template <typename InIt, typename OutIt, typename T, typename Op>
+void								parallel_exclusive_scan(InIt first, InIt last, OutIt out,
+															const T &init, const Op &op, const size_t grain,
+															ThreadPool &pool = ThreadPool::shared());
+
+/**
+ * IMPLEMENTATION - parallel_for
+ */
+template <typename F>
+void parallel_for(	const size_t begin, const size_t end, const size_t grain,
+					const F &fn, ThreadPool &pool) {
+	struct Thunk {
+		static void	run(const void *ctx, const size_t b, const size_t e) {
+			(*static_cast<const F*>(ctx))(b, e);
+		}
+	};
+	pool.run(begin, end, grain, &Thunk::run, &fn);
+}
+
+/**
+ * IMPLEMENTATION - parallel_reduce
+ */
+template <typename T, typename Map, typename Combine>
+T parallel_reduce(	const size_t begin, const size_t end, const size_t grain,
+					const T &identity, const Map &map, const Combine &combine,
+					ThreadPool &pool) {
+	if (end <= begin) return identity;
+	const size_t			chunk = pool.grainFor(end-begin, grain);
+	std::vector<T>			results((end - begin + chunk - 1) / chunk, identity);
+	parallel_for(begin, end, chunk, [&](const size_t b, const size_t e) {
+		results[(b - begin) / chunk] = map(b, e);
+	}, pool);
+
+	T						ans(identity);
+	for (const auto& r : results) ans = combine(ans, r);
+	return ans;
+}
+
+/**
+ * IMPLEMENTATION - parallel_exclusive_scan
+ */
+template <typename InIt, typename OutIt, typename T, typename Op>
+void parallel_exclusive_scan(	InIt first, InIt last, OutIt out,
+								const T &init, const Op &op, const size_t grain,
+								ThreadPool &pool) {
+	if (last <= first) return;
+	const size_t			count = static_cast<size_t>(last - first);
+	const size_t			chunk = pool.grainFor(count, grain);
+	const size_t			chunks = (count + chunk - 1) / chunk;
+
+	// Pass 1: total each chunk.
+	std::vector<T>			sums(chunks);
+	parallel_for(0, count, chunk, [&](const size_t b, const size_t e) {
+		T					sum(first[b]);
+		for (size_t k=b+1; k<e; ++k) sum = op(sum, first[k]);
+		sums[b / chunk] = sum;
+	}, pool);
+
+	// Scan the chunk totals into each chunk's starting value.
+	T						acc(init);
+	for (auto& s : sums) {
+		const T				next(op(acc, s));
+		s = acc;
+		acc = next;
+	}
+
+	// Pass 2: scan each chunk from its start. Read before writing, in
+	// case the scan is in place.
+	parallel_for(0, count, chunk, [&](const size_t b, const size_t e) {
+		T					acc(sums[b / chunk]);
+		for (size_t k=b; k<e; ++k) {
+			const T			v(first[k]);
+			out[k] = acc;
+			acc = op(acc, v);
+		}
+	}, pool);
+}
+
+} // namespace async
+} // namespace kt
+
+#endif
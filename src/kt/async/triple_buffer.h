@@ -0,0 +1,61 @@
+#ifndef KT_ASYNC_TRIPLEBUFFER_H_
+#define KT_ASYNC_TRIPLEBUFFER_H_
+
+#include <atomic>
+
+namespace kt {
+namespace async {
+
+/**
+ * @class kt::async::TripleBuffer
+ * @brief Hand the latest of a stream of values from one writer thread to one
+ * reader thread, without either waiting. The writer fills back() and publishes
+ * it; the reader picks up whatever was published last. Values the reader
+ * never picks up are overwritten. Slots are reused, so a value's buffers
+ * survive the trip and don't need to be reallocated.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() { mMiddle.store(1); }
+
+	// Writer.
+	T&							back() { return mSlots[mBack]; }
+	void						publish() {
+		mBack = mMiddle.exchange(mBack | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Reader. Answer true if a value has been published since the last update().
+	bool						hasUpdate() const {
+		return (mMiddle.load(std::memory_order_relaxed) & FRESH) != 0;
+	}
+	// Answer true if there was a new value, which is now front().
+	// The old front goes back to the writer.
+	bool						update() {
+		if ((mMiddle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+		mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+	// The reader can modify it, but the writer will see the changes.
+	T&							front() { return mSlots[mFront]; }
+	const T&					front() const { return mSlots[mFront]; }
+
+private:
+	TripleBuffer(const TripleBuffer&);
+	TripleBuffer&				operator=(const TripleBuffer&);
+
+	static const unsigned		INDEX = 3,
+								FRESH = 4;
+
+	T							mSlots[3];
+	// Only the writer touches back, only the reader touches front.
+	unsigned					mBack = 0,
+								mFront = 2;
+	// The index of the middle slot, and whether it holds an unread value.
+	std::atomic<unsigned>		mMiddle;
+};
+
+} // namespace async
+} // namespace kt
+
+#endif
@@ -13,25 +13,54 @@
  */
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
+#include "spsc_queue.h"
+#include "thread_attributes.h"
 
 namespace kt {
 namespace async {
 
+/**
+ * @class kt::async::WorkerStats
+ * @brief Handoff latency, in seconds. Start is the wait from run() until the
+ * worker picks the op up, handle is the wait from the op finishing until the
+ * main thread handles it.
+ */
+class WorkerStats {
+public:
+	WorkerStats() { }
+
+	void								add(const WorkerStats&);
+	double								averageStart() const { return mCount > 0 ? mStartTotal / mCount : 0.0; }
+	double								averageHandle() const { return mCount > 0 ? mHandleTotal / mCount : 0.0; }
+
+	size_t								mCount = 0;
+	double								mStartTotal = 0.0,
+										mStartMax = 0.0,
+										mHandleTotal = 0.0,
+										mHandleMax = 0.0;
+};
+
 /**
  * @class kt::async::WorkerThread
  * @brief Handle running an operation in a separate thread. Assume a basic pattern of
  * supplying an IO (input/output) object, running it in the thread, and returning it as an output object.
+ * Ops travel through lock-free queues; run() and update() must only be called from the
+ * main thread.
  ** IMPLICIT INTERFACE
  *		// For both functions, ThreadData is the TD template parameter
  *		// replace() is an optimization -- ThisClass is a different instance
  *		// of the IO class. If you return true, then run() will not be called on ThisClass.
- *		// ThisClass will always be an earlier operation in the list.
+ *		// ThisClass will always be an earlier operation in the list. It is still
+ *		// returned to the handler, so mark it if the handler needs to know.
  *		bool		replace(ThisClass&, ThreadData&) { return false; }
  *		void		run(ThreadData&)
  */
@@ -41,32 +70,66 @@ class WorkerThread {
 public:
 	// Set a handler to receive notification when an IO operation is complete. This is
 	// always called from the main thread. Clients can take ownership of the ptr if they want.
+	// The thread applies the attributes (or just a name) when it starts.
 	WorkerThread(	const std::function<void(std::unique_ptr<IO>&)> &handler_fn,
-					const std::string &name);
+					const ThreadAttributes &attributes);
 	~WorkerThread();
 
 	void								run(std::unique_ptr<IO>);
 	void								update();
 
+	const WorkerStats&					getStats() const { return mStats; }
+
 private:
 	WorkerThread();
 	WorkerThread(const WorkerThread<IO, TD>&);
 	WorkerThread&						operator=(const WorkerThread<IO, TD>&);
 	void								loop();
+	// Worker side. Block until there's input, spinning briefly first. With
+	// output still waiting for room, only block for a moment.
+	void								wait(const bool pending_output);
+	// Main side. Wake the worker if it's blocked.
+	void								wake();
+	void								flushInput();
+
+	typedef std::chrono::steady_clock	Clock;
+	// An op and its handoff times.
+	class Envelope {
+	public:
+		Envelope() { }
+		Envelope(Envelope &&e) { *this = std::move(e); }
+		Envelope&						operator=(Envelope &&e) {
+			mIo = std::move(e.mIo);
+			mEnqueued = e.mEnqueued;
+			mStarted = e.mStarted;
+			mFinished = e.mFinished;
+			return *this;
+		}
+
+		std::unique_ptr<IO>				mIo;
+		Clock::time_point				mEnqueued,
+										mStarted,
+										mFinished;
+	};
+
+	static const size_t					QUEUE_SIZE = 64;
+	static const size_t					SPIN_COUNT = 64;
 
 	const std::function<void(std::unique_ptr<IO>&)>
 										mHandlerFn;
 
-	const std::string					mName;
+	const ThreadAttributes				mAttributes;
 	std::thread							mThread;
-	std::atomic_bool					mStop;
-	std::mutex							mConditionMutex,
-										mTransportMutex;
+	std::atomic_bool					mStop,
+										mWaiting;
+	std::mutex							mWaitMutex;
 	std::condition_variable				mCondition;
 
-	std::deque<std::unique_ptr<IO>>		mInput;
-	std::vector<std::unique_ptr<IO>>	mOutput,
-										mHandleOutput;
+	SpscQueue<Envelope>					mInput,
+										mOutput;
+	// Main side. Input that didn't fit in the queue.
+	std::deque<Envelope>				mPendingInput;
+	WorkerStats							mStats;
 };
 
 /**
@@ -79,13 +142,18 @@ class OperatorThread {
 public:
 	// Set a handler to receive notification when an IO operation is complete.
 	OperatorThread(	const std::function<void(IO&)> &handler_fn,
-					const std::string &name = "");
+					const ThreadAttributes &attributes = ThreadAttributes());
 
-	// A new IO is generated automatically; the start_fn can be used to initialize it
-	// before it goes off to the thread to run.
-	void								run(const std::function<void(IO&)> &start_fn = nullptr);
+	// A new IO is generated automatically; the start_fn(IO&) can be used to initialize
+	// it before it goes off to the thread to run. Any callable works, without being
+	// wrapped in a std::function.
+	void								run();
+	template <typename F>
+	void								run(const F &start_fn);
 	void								update() { mLoop.update(); }
 
+	const WorkerStats&					getStats() const { return mLoop.getStats(); }
+
 private:
 	void								finished(std::unique_ptr<IO>&);
 
@@ -100,15 +168,29 @@ private:
 	std::vector<std::unique_ptr<IO>>	mRetired;
 };
 
+/**
+ * IMPLEMENTATION - WorkerStats
+ */
+inline void WorkerStats::add(const WorkerStats &s) {
+	mCount += s.mCount;
+	mStartTotal += s.mStartTotal;
+	mHandleTotal += s.mHandleTotal;
+	if (s.mStartMax > mStartMax) mStartMax = s.mStartMax;
+	if (s.mHandleMax > mHandleMax) mHandleMax = s.mHandleMax;
+}
+
 /**
  * IMPLEMENTATION - WorkerThread
  */
 template <typename IO, typename TD>
 WorkerThread<IO, TD>::WorkerThread(	const std::function<void(std::unique_ptr<IO>&)> &handler_fn,
-									const std::string &name)
-		: mName(name)
-		, mHandlerFn(handler_fn) {
+									const ThreadAttributes &attributes)
+		: mHandlerFn(handler_fn)
+		, mAttributes(attributes)
+		, mInput(QUEUE_SIZE)
+		, mOutput(QUEUE_SIZE) {
 	mStop.store(false);
+	mWaiting.store(false);
 	mThread = std::thread([this](){loop();});
 }
 
@@ -116,6 +198,9 @@ template <typename IO, typename TD>
 WorkerThread<IO, TD>::~WorkerThread() {
 	try {
 		mStop.store(true);
+		{
+			std::lock_guard<std::mutex> lock(mWaitMutex);
+		}
 		mCondition.notify_all();
 		mThread.join();
 	} catch (std::exception const&) {
@@ -126,70 +211,115 @@ template <typename IO, typename TD>
 void WorkerThread<IO, TD>::run(std::unique_ptr<IO> io) {
 	if (!io) return;
 	try {
-		{
-			std::lock_guard<std::mutex> lock(mTransportMutex);
-			mInput.push_back(std::move(io));
-		}
-		mCondition.notify_all();
+		Envelope		e;
+		e.mIo = std::move(io);
+		e.mEnqueued = Clock::now();
+		mPendingInput.push_back(std::move(e));
+		flushInput();
 	} catch (std::exception const&) {
 	}
 }
 
 template <typename IO, typename TD>
 void WorkerThread<IO, TD>::update() {
-	mHandleOutput.clear();
-	{
-		std::lock_guard<std::mutex> lock(mTransportMutex);
-		mHandleOutput.swap(mOutput);
-	}
-	for (auto& e : mHandleOutput) {
-		if (e && mHandlerFn) mHandlerFn(e);
+	// Anything that didn't fit last time.
+	if (!mPendingInput.empty()) flushInput();
+
+	Envelope			e;
+	while (mOutput.pop(e)) {
+		const Clock::time_point	now = Clock::now();
+		const double	start = std::chrono::duration<double>(e.mStarted - e.mEnqueued).count(),
+						handle = std::chrono::duration<double>(now - e.mFinished).count();
+		++mStats.mCount;
+		mStats.mStartTotal += start;
+		mStats.mHandleTotal += handle;
+		if (start > mStats.mStartMax) mStats.mStartMax = start;
+		if (handle > mStats.mHandleMax) mStats.mHandleMax = handle;
+
+		if (e.mIo && mHandlerFn) mHandlerFn(e.mIo);
 	}
 }
 
 template <typename IO, typename TD>
 void WorkerThread<IO, TD>::loop() {
+	mAttributes.apply();
+
 	TD									thread_data;
-	std::deque<std::unique_ptr<IO>>		input;
+	std::deque<Envelope>				input,
+										output;
+	Envelope							e;
 	while (!mStop.load()) {
 		// Get input
-		{
-			std::lock_guard<std::mutex> lock(mTransportMutex);
-			input.swap(mInput);
-		}
+		while (mInput.pop(e)) input.push_back(std::move(e));
 
 		// Process and push to output
-		{
-			while (!input.empty()) {
-				std::unique_ptr<IO>		op(std::move(input.front()));
-				input.pop_front();
-				if (input.empty() || !input.front()->replace(*(op.get()), thread_data)) {
-					try {
-						op->run(thread_data);
-					} catch (std::exception const&) {
-					}
-					std::lock_guard<std::mutex> lock(mTransportMutex);
-					try {
-						mOutput.push_back(std::move(op));
-					} catch (std::exception const&) {
-					}
+		while (!input.empty()) {
+			Envelope					op(std::move(input.front()));
+			input.pop_front();
+			// Anything that's arrived since is a candidate to replace this op.
+			while (mInput.pop(e)) input.push_back(std::move(e));
+			op.mStarted = Clock::now();
+			if (!op.mIo) continue;
+			if (input.empty() || !input.front().mIo || !input.front().mIo->replace(*(op.mIo.get()), thread_data)) {
+				try {
+					op.mIo->run(thread_data);
+				} catch (std::exception const&) {
 				}
 			}
-			input.clear();
+			op.mFinished = Clock::now();
+			// Replaced ops go back too, so they can be recycled.
+			output.push_back(std::move(op));
+			while (!output.empty() && mOutput.push(std::move(output.front()))) output.pop_front();
 		}
+		while (!output.empty() && mOutput.push(std::move(output.front()))) output.pop_front();
 
 		// Wait
 		if (mStop.load()) break;
-		std::unique_lock<std::mutex>	lock(mConditionMutex);
-		bool							needs_wait(true);
-		{
-			std::lock_guard<std::mutex> lock(mTransportMutex);
-			needs_wait = mInput.empty();
-		}
-	    if (needs_wait) {
-			mCondition.wait(lock);
-		}
+		wait(!output.empty());
+	}
+}
+
+template <typename IO, typename TD>
+void WorkerThread<IO, TD>::wait(const bool pending_output) {
+	// Most handoffs land within a frame, so a short spin often avoids
+	// sleeping at all.
+	for (size_t k=0; k<SPIN_COUNT; ++k) {
+		if (mStop.load() || !mInput.empty()) return;
+		std::this_thread::yield();
 	}
+
+	std::unique_lock<std::mutex>		lock(mWaitMutex);
+	// Announce the wait before the final check. Paired with the fence in
+	// wake(), either the producer sees mWaiting or I see its input, so a
+	// wakeup can't be lost.
+	mWaiting.store(true);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	auto								ready = [this]() { return mStop.load() || !mInput.empty(); };
+	if (pending_output) mCondition.wait_for(lock, std::chrono::milliseconds(1), ready);
+	else mCondition.wait(lock, ready);
+	mWaiting.store(false);
+}
+
+template <typename IO, typename TD>
+void WorkerThread<IO, TD>::wake() {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!mWaiting.load()) return;
+	{
+		// The worker holds the lock from announcing the wait until it's
+		// actually waiting, so taking it means the notify can't slip in between.
+		std::lock_guard<std::mutex>		lock(mWaitMutex);
+	}
+	mCondition.notify_one();
+}
+
+template <typename IO, typename TD>
+void WorkerThread<IO, TD>::flushInput() {
+	bool								pushed = false;
+	while (!mPendingInput.empty() && mInput.push(std::move(mPendingInput.front()))) {
+		mPendingInput.pop_front();
+		pushed = true;
+	}
+	if (pushed) wake();
 }
 
 /**
@@ -197,13 +327,19 @@ void WorkerThread<IO, TD>::loop() {
  */
 template <typename IO, typename TD>
 OperatorThread<IO, TD>::OperatorThread(	const std::function<void(IO&)> &handler_fn,
-										const std::string &name)
+										const ThreadAttributes &attributes)
 		: mHandlerFn(handler_fn)
-		, mLoop([this](std::unique_ptr<IO>& ptr){finished(ptr); }, name) {
+		, mLoop([this](std::unique_ptr<IO>& ptr){finished(ptr); }, attributes) {
+}
+
+template <typename IO, typename TD>
+void OperatorThread<IO, TD>::run() {
+	run([](IO&) { });
 }
 
 template <typename IO, typename TD>
-void OperatorThread<IO, TD>::run(const std::function<void(IO&)> &start_fn) {
+template <typename F>
+void OperatorThread<IO, TD>::run(const F &start_fn) {
 	try {
 		std::unique_ptr<IO>			ptr;
 		while (!mRetired.empty()) {
@@ -213,7 +349,7 @@ void OperatorThread<IO, TD>::run(const std::function<void(IO&)> &start_fn) {
 		}
 		if (!ptr) ptr.reset(new IO());
 		if (!ptr) return;
-		if (start_fn) start_fn(*(ptr.get()));
+		start_fn(*(ptr.get()));
 		mLoop.run(std::move(ptr));
 	} catch (std::exception const&) {
 	}
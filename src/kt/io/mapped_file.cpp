@@ -0,0 +1,108 @@
+#include "mapped_file.h"
+
+#include <cinder/Cinder.h>
+
+#include <stdexcept>
+
+#ifdef CINDER_MSW
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace kt {
+namespace io {
+
+/**
+ * @class kt::io::MappedFile
+ */
+MappedFile::MappedFile() {
+}
+
+MappedFile::MappedFile(const std::string &path) {
+	open(path);
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef CINDER_MSW
+
+void MappedFile::open(const std::string &path) {
+	close();
+
+	HANDLE				file = CreateFileA(	path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+											OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("MappedFile can't open " + path);
+	mFile = file;
+
+	LARGE_INTEGER		size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart < 1) {
+		close();
+		throw std::runtime_error("MappedFile can't size " + path);
+	}
+
+	mMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mMapping) {
+		close();
+		throw std::runtime_error("MappedFile can't map " + path);
+	}
+	mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (!mData) {
+		close();
+		throw std::runtime_error("MappedFile can't view " + path);
+	}
+	mSize = static_cast<size_t>(size.QuadPart);
+}
+
+void MappedFile::close() {
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile) CloseHandle(mFile);
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = nullptr;
+	mSize = 0;
+}
+
+#else
+
+void MappedFile::open(const std::string &path) {
+	close();
+
+	const int			fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error("MappedFile can't open " + path);
+
+	struct stat			st;
+	if (fstat(fd, &st) != 0 || st.st_size < 1) {
+		::close(fd);
+		throw std::runtime_error("MappedFile can't size " + path);
+	}
+
+	void*				data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping holds its own reference to the file.
+	::close(fd);
+	if (data == MAP_FAILED) throw std::runtime_error("MappedFile can't map " + path);
+
+	madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+	mData = static_cast<const uint8_t*>(data);
+	mSize = static_cast<size_t>(st.st_size);
+}
+
+void MappedFile::close() {
+	if (mData) munmap(const_cast<uint8_t*>(mData), mSize);
+	mData = nullptr;
+	mSize = 0;
+}
+
+#endif
+
+} // namespace io
+} // namespace kt
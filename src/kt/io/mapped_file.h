@@ -0,0 +1,45 @@
+#ifndef KT_IO_MAPPEDFILE_H_
+#define KT_IO_MAPPEDFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace kt {
+namespace io {
+
+/**
+ * @class kt::io::MappedFile
+ * @brief Map a file into memory, read-only. Pages are loaded by the OS as
+ * they're touched, so opening is instant regardless of file size.
+ */
+class MappedFile {
+public:
+	MappedFile();
+	// Throws if the file can't be mapped.
+	explicit MappedFile(const std::string &path);
+	~MappedFile();
+
+	void							open(const std::string &path);
+	void							close();
+
+	bool							empty() const { return mSize < 1; }
+	const uint8_t*					data() const { return mData; }
+	size_t							size() const { return mSize; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile&						operator=(const MappedFile&);
+
+	const uint8_t*					mData = nullptr;
+	size_t							mSize = 0;
+#ifdef CINDER_MSW
+	void*							mFile = nullptr;
+	void*							mMapping = nullptr;
+#endif
+};
+
+} // namespace io
+} // namespace kt
+
+#endif
@@ -126,6 +126,14 @@ float				hermite_at(const float index, const std::vector<float> &vec) {
 /**
  * @class kt::Cube
  */
+bool Cube::operator==(const Cube &o) const {
+	return mNearLL == o.mNearLL && mNearUR == o.mNearUR && mFarLL == o.mFarLL && mFarUR == o.mFarUR;
+}
+
+bool Cube::operator!=(const Cube &o) const {
+	return !(*this == o);
+}
+
 glm::vec3 Cube::atUnit(const glm::vec3 &unit) const {
 	glm::vec2		ll(glm::mix(mNearLL, mFarLL, unit.z));
 	glm::vec2		ur(glm::mix(mNearUR, mFarUR, unit.z));
@@ -61,6 +61,9 @@ class Cube {
 public:
 	Cube() { }
 
+	bool						operator==(const Cube&) const;
+	bool						operator!=(const Cube&) const;
+
 	// Given a unit position (all values 0-1) translate to a position in the cube.
 	glm::vec3					atUnit(const glm::vec3&) const;
 	// Given a point somewhere in my bounds, answer a unit point.
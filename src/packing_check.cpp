@@ -0,0 +1,58 @@
+#include "packing_check.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <cinder/Rand.h>
+#include "instance_packer.h"
+
+namespace cs {
+
+/**
+ * @class cs::PackingCheck
+ */
+const float				PackingCheck::MAX_PIXELS = 0.1f;
+
+/**
+ * @func check_packing
+ */
+PackingCheck check_packing(	const kt::math::Cube &bounds, const kt::math::Cube &visible,
+							const ci::CameraPersp &camera, const glm::vec2 &screen,
+							const size_t count, const uint32_t seed) {
+	// Position and alpha, the layout pack() reads.
+	std::vector<glm::vec4>	src(count);
+	ci::Rand				rand(seed);
+	for (auto& p : src) {
+		const glm::vec3		unit(rand.nextFloat(), rand.nextFloat(), rand.nextFloat());
+		p = glm::vec4(visible.atUnit(unit), 1.0f);
+	}
+
+	// All at once takes the SSE2 path where there is one; one at a time
+	// always takes the scalar path.
+	const InstancePacker	packer(bounds);
+	std::vector<Instance>	fast(count);
+	packer.pack(&src.front().x, sizeof(glm::vec4), count, fast.data());
+
+	PackingCheck			ans;
+	double					total = 0.0;
+	for (size_t k=0; k<count; ++k) {
+		Instance			scalar;
+		packer.pack(&src[k].x, sizeof(glm::vec4), 1, &scalar);
+		const Instance&		i(fast[k]);
+		ans.mMaxPathSteps = std::max(ans.mMaxPathSteps, std::abs(static_cast<int>(i.mX) - static_cast<int>(scalar.mX)));
+		ans.mMaxPathSteps = std::max(ans.mMaxPathSteps, std::abs(static_cast<int>(i.mY) - static_cast<int>(scalar.mY)));
+		ans.mMaxPathSteps = std::max(ans.mMaxPathSteps, std::abs(static_cast<int>(i.mZ) - static_cast<int>(scalar.mZ)));
+
+		const glm::vec2		want = camera.worldToScreen(glm::vec3(src[k].x, src[k].y, src[k].z), screen.x, screen.y);
+		if (want.x < 0.0f || want.y < 0.0f || want.x > screen.x || want.y > screen.y) continue;
+		const glm::vec2		got = camera.worldToScreen(packer.unpack(i), screen.x, screen.y);
+		const float			error = glm::distance(want, got);
+		ans.mMaxPixels = std::max(ans.mMaxPixels, error);
+		total += error;
+		++ans.mPoints;
+	}
+	if (ans.mPoints > 0) ans.mMeanPixels = static_cast<float>(total / static_cast<double>(ans.mPoints));
+	return ans;
+}
+
+} // namespace cs
@@ -1,6 +1,7 @@
 #ifndef CS_PARTICLE_H_
 #define CS_PARTICLE_H_
 
+#include <cstdint>
 #include <memory>
 #include <cinder/Color.h>
 #include <cinder/Vector.h>
@@ -8,6 +9,14 @@
 
 namespace cs {
 
+// Colors are packed RGBA8, red in the low byte, so they go to the
+// GPU as they are.
+const uint32_t			RGBA8_WHITE = 0xffffffff;
+
+inline uint32_t			to_rgba8(const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a = 255) {
+	return static_cast<uint32_t>(r) | (static_cast<uint32_t>(g) << 8) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(a) << 24);
+}
+
 /**
  * @class cs::Particle
  */
@@ -16,20 +25,29 @@ public:
 	Particle() { }
 	explicit Particle(const glm::vec3 &pos) : mPosition(pos) { }
 	explicit Particle(const glm::vec3 &pos, const float a) : mPosition(pos), mAlpha(a) { }
+	explicit Particle(const glm::vec3 &pos, const float a, const uint32_t clr) : mPosition(pos), mAlpha(a), mColor(clr) { }
 
 	// Computed values during rendering.
 	glm::vec3			mPosition = glm::vec3(0);
 	float				mAlpha = 1.0f;
+	uint32_t			mColor = RGBA8_WHITE;
 
 	// Alpha level of the particle.
 	float				mStartAlpha = 1.0f,
 						mEndAlpha = 1.0f;
+	// Color of the particle, blended along the curve like the alpha.
+	uint32_t			mStartColor = RGBA8_WHITE,
+						mEndColor = RGBA8_WHITE;
 
 	kt::math::Bezier3f	mCurve;
 	float				mCurveLength = 0.0f;
 
 	// Used to signify I can create accent particles
 	bool				mHasAccents = false;
+	// Which accent this is, so drawing can treat it the same from frame to
+	// frame, though accents die out of order. Main particles are known by
+	// their place in the frame, which doesn't change.
+	uint32_t			mId = 0;
 };
 
 } // namespace cs
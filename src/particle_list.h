@@ -1,6 +1,7 @@
 #ifndef CS_PARTICLELIST_H_
 #define CS_PARTICLELIST_H_
 
+#include <utility>
 #include <vector>
 #include "particle.h"
 
@@ -13,6 +14,16 @@ class ParticleList : public std::vector<Particle> {
 public:
 	ParticleList() { }
 
+	// Swap the particles and the parameters. Used to pass frames between
+	// threads without copying.
+	inline void		swap(ParticleList &l) {
+		std::vector<Particle>::swap(l);
+		std::swap(mMaxCurveLength, l.mMaxCurveLength);
+		std::swap(mAverageCurveLength, l.mAverageCurveLength);
+		std::swap(mTransitionDuration, l.mTransitionDuration);
+		std::swap(mHoldDuration, l.mHoldDuration);
+	}
+
 	inline void		setParametersFrom(const ParticleList &l) {
 		mMaxCurveLength = l.mMaxCurveLength;
 		mAverageCurveLength = l.mAverageCurveLength;
@@ -1,5 +1,9 @@
 #include "particle_render.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
 #include <cinder/gl/Batch.h>
 #include <cinder/gl/draw.h>
 #include <cinder/gl/gl.h>
@@ -7,19 +11,42 @@
 #include <cinder/CinderMath.h>
 #include <cinder/ImageIo.h>
 #include "kt/app/kt_cns.h"
-#include "kt/app/kt_environment.h"
+#include "kt/async/thread_pool.h"
 #include "feeder.h"
+#include "program_cache.h"
 #include "settings.h"
 
 namespace cs {
 
 namespace {
+// Particles per chunk when packing in parallel.
+const size_t		PACK_GRAIN = 4096;
+// Chunk counts per chunk when scanning them for compaction. There are
+// only a few, so in practice this is serial.
+const size_t		COMPACT_SCAN_GRAIN = 1024;
+// How long to block on a fence before checking again.
+const GLuint64		FENCE_TIMEOUT_NS = 1000000;
+// Smallest a particle draws, in pixels, into a scaled down buffer.
+const float			MIN_PIXELS = 1.0f;
 
+#if ! defined( CINDER_GL_ES )
 /**
- * @func make_texture
- * @brief Create the standard jot texture.
+ * @func wait_fence
+ * @brief Block until the fence is signalled, then delete it.
  */
-ci::gl::TextureRef	make_texture(const kt::Cns&);
+void				wait_fence(GLsync&);
+
+bool				gl_version_at_least(const GLint major, const GLint minor) {
+	const std::pair<GLint, GLint>	v = ci::gl::getVersion();
+	return v.first > major || (v.first == major && v.second >= minor);
+}
+#endif
+
+/**
+ * @func make_jot
+ * @brief Create the standard jot image, a cell across. Any thread.
+ */
+ci::Surface8u		make_jot(const glm::vec2 &cell_size);
 
 }
 
@@ -29,87 +56,492 @@ ci::gl::TextureRef	make_texture(const kt::Cns&);
 ParticleRender::ParticleRender(const kt::Cns &cns, const cs::Settings &settings)
 		: mCns(cns)
 		, mSettings(settings) {
+#if ! defined( CINDER_GL_ES )
+	for (size_t k=0; k<RING_FRAMES; ++k) mRingFences[k] = nullptr;
+#endif
+
+	// The jot is drawn on the pool while the app starts; setup() uploads it.
+	const glm::vec2			cell_size(cns.mCellSizeInPixelsRaw);
+	mJot = kt::async::run(kt::async::PoolExecutor::shared(), [cell_size]() { return make_jot(cell_size); });
+}
+
+void ParticleRender::setup() {
+	if (mGlsl) return;
 
 	// Load the texture
-	mTexture = make_texture(cns);
+	mTexture = ci::gl::Texture::create(mJot.get());
 	if (!mTexture) throw std::runtime_error("ParticleRender vbo can't create texture");
+	mJot = kt::async::Task<ci::Surface8u>();
 
 	// Load the shader
-	mGlsl = ci::gl::GlslProg::create(	ci::loadFile(kt::env::expand("$(DATA)/shaders/particle_instanced.vert")),
-										ci::loadFile(kt::env::expand("$(DATA)/shaders/particle_instanced.frag")) );
+	mGlsl = ProgramCache::shared().load("$(DATA)/shaders/particle_instanced.vert", "$(DATA)/shaders/particle_instanced.frag");
 	if (!mGlsl) throw std::runtime_error("ParticleRender vbo can't create shader");
 
+	// create the VBO which will contain per-instance (rather than per-vertex) data
+	reserveBuffer(BUFFER_SIZE);
+	mGlsl->uniform("uColored", mColors ? 1 : 0);
+
+	// The ring is allocated once I know how much I'm drawing. ES has no
+	// buffer storage or base instance, so it always maps and replaces.
+#if ! defined( CINDER_GL_ES )
+	mPersistent = mSettings.mPersistentInstances
+			&& (gl_version_at_least(4, 4)
+				|| (ci::gl::isExtensionAvailable("GL_ARB_buffer_storage") && ci::gl::isExtensionAvailable("GL_ARB_base_instance")));
+#endif
+}
+
+ParticleRender::~ParticleRender() {
+	releaseRing();
+}
+
+void ParticleRender::setColors(const bool on) {
+	if (on == mColors) return;
+	mColors = on;
+	// Anything staged is the wrong shape.
+	mStaging.clear();
+	mColorStaging.clear();
+
+	// The buffers change shape. The ring comes back at the next submit.
+	releaseRing();
+	reserveBuffer(mBufferCapacity);
+	mGlsl->uniform("uColored", mColors ? 1 : 0);
+	if (mPointGlsl) mPointGlsl->uniform("uColored", mColors ? 1 : 0);
+	if (mCurveBatch) mCurveBatch->getGlslProg()->uniform("uColored", mColors ? 1 : 0);
+}
+
+void ParticleRender::setPoints(const bool on) {
+	if (on == mPoints) return;
+	if (on && !mPointGlsl) {
+		mPointGlsl = ProgramCache::shared().load("$(DATA)/shaders/particle_point.vert", "$(DATA)/shaders/particle_point.frag");
+		if (!mPointGlsl) throw std::runtime_error("ParticleRender can't create point shader");
+		mPointGlsl->uniform("uColored", mColors ? 1 : 0);
+	}
+	mPoints = on;
+
+	// The staging is the same shape, only the batches change.
+	releaseRing();
+	reserveBuffer(mBufferCapacity);
+}
+
+void ParticleRender::drawParticles(const ParticleList &particles) {
+	pack(std::vector<const ParticleList*>(1, &particles));
+	submit();
+}
+
+ParticleRender::Source ParticleRender::sourceFor(const ParticleList &list, const bool ids) {
+	// The packer reads the alpha straight after the position.
+	static_assert(offsetof(Particle, mAlpha) == offsetof(Particle, mPosition) + 3 * sizeof(float), "Particle alpha must follow position");
+
+	if (list.empty()) return Source();
+	const Particle&				front(list.front());
+	return Source(	&front.mPosition.x, sizeof(Particle), list.size(), &front.mColor, sizeof(Particle),
+					ids ? &front.mId : nullptr, sizeof(Particle));
+}
+
+void ParticleRender::pack(const std::vector<const ParticleList*> &lists) {
+	std::vector<Source>			sources;
+	for (const auto& list : lists) sources.push_back(sourceFor(*list));
+	pack(sources);
+}
+
+void ParticleRender::pack(const std::vector<Source> &sources) {
+	mPacker = InstancePacker(mCns.mWorldBounds);
+	if (mSettings.mCullInstances) mPacker.setVisible(mCns.mExactWorldBounds, mCns.mParticleSize.x / 2.0f);
+	const bool					thinning = mSettings.mThinSaturated,
+								clustering = mSettings.mClusterFar;
+	// Culled, thinned or clustered chunks come out short, so they're packed
+	// to scratch and then compacted into the staging.
+	const bool					compacting = mPacker.isCulling() || thinning || clustering;
+	size_t						size = 0,
+								all_chunks = 0;
+	for (const auto& src : sources) {
+		size += src.mCount;
+		all_chunks += (src.mCount + PACK_GRAIN - 1) / PACK_GRAIN;
+	}
+	mStaging.resize(size);
+	if (mColors) mColorStaging.resize(size);
+	if (thinning) mDensity.begin(mPacker, mCns.mParticleSize.x, mSettings.mThinBudget);
+	if (clustering) mClusters.begin(mPacker, mCns.mParticleSize.x, mSettings.mClusterDepth, size, all_chunks);
+	if (compacting) {
+		mScratch.resize(size);
+		if (mColors) mColorScratch.resize(size);
+	}
+	if (thinning) mIdScratch.resize(size);
+
+	const InstancePacker&		packer(mPacker);
+	TileDensity*				density = (thinning ? &mDensity : nullptr);
+	ClusterLod*					clusters = (clustering ? &mClusters : nullptr);
+	size_t						start = 0,
+								kept = 0,
+								visible = 0,
+								unthinned = 0,
+								first_chunk = 0;
+	for (const auto& src : sources) {
+		const char*				data = reinterpret_cast<const char*>(src.mData);
+		const size_t			stride = src.mStride,
+								count = src.mCount;
+		const uint32_t*			colors = (mColors ? src.mColors : nullptr);
+		const size_t			color_stride = src.mColorStride;
+		Instance*				dst = (compacting ? mScratch.data() : mStaging.data()) + start;
+		uint32_t*				color_dst = (colors ? (compacting ? mColorScratch.data() : mColorStaging.data()) + start : nullptr);
+		// A particle's id is the one its source gives it, or else its place
+		// in the source.
+		uint32_t*				id_dst = (thinning ? mIdScratch.data() + start : nullptr);
+		const char*				ids = reinterpret_cast<const char*>(src.mIds);
+		const size_t			id_stride = src.mIdStride;
+
+		const size_t			chunks = (count + PACK_GRAIN - 1) / PACK_GRAIN;
+		mChunkCounts.assign(chunks, 0);
+		mChunkVisible.assign(chunks, 0);
+		mChunkUnthinned.assign(chunks, 0);
+		size_t*					chunk_counts = mChunkCounts.data();
+		size_t*					chunk_visible = mChunkVisible.data();
+		size_t*					chunk_unthinned = mChunkUnthinned.data();
+		kt::async::parallel_for(0, chunks, 1, [&packer, density, clusters, first_chunk, data, stride, count, colors, color_stride, dst, color_dst, id_dst, ids, id_stride, chunk_counts, chunk_visible, chunk_unthinned](const size_t b, const size_t e) {
+			for (size_t c=b; c<e; ++c) {
+				const size_t	i = c * PACK_GRAIN;
+				size_t			n = packer.pack(reinterpret_cast<const float*>(data + i * stride), stride,
+												colors ? reinterpret_cast<const uint32_t*>(reinterpret_cast<const char*>(colors) + i * color_stride) : nullptr, color_stride,
+												std::min(PACK_GRAIN, count - i), dst + i, color_dst ? color_dst + i : nullptr,
+												id_dst ? id_dst + i : nullptr, static_cast<uint32_t>(i),
+												ids ? reinterpret_cast<const uint32_t*>(ids + i * id_stride) : nullptr, id_stride);
+				chunk_visible[c] = n;
+				if (density) n = density->thin(dst + i, color_dst ? color_dst + i : nullptr, id_dst + i, n);
+				chunk_unthinned[c] = n;
+				if (clusters) n = clusters->take(first_chunk + c, dst + i, color_dst ? color_dst + i : nullptr, n);
+				chunk_counts[c] = n;
+			}
+		});
+		for (size_t c=0; c<chunks; ++c) {
+			visible += chunk_visible[c];
+			unthinned += chunk_unthinned[c];
+		}
+		first_chunk += chunks;
+
+		// Where this source's instances end up, once compacted.
+		size_t					span_count = count;
+		if (compacting && chunks > 0) {
+			// Each chunk's place in the span is the total kept before it.
+			mChunkOffsets.resize(chunks);
+			kt::async::parallel_exclusive_scan(mChunkCounts.begin(), mChunkCounts.end(), mChunkOffsets.begin(),
+											   size_t(0), std::plus<size_t>(), COMPACT_SCAN_GRAIN);
+			span_count = mChunkOffsets.back() + mChunkCounts.back();
+			const size_t*		offsets = mChunkOffsets.data();
+			Instance*			out = mStaging.data() + kept;
+			uint32_t*			color_out = (color_dst ? mColorStaging.data() + kept : nullptr);
+			kt::async::parallel_for(0, chunks, 1, [dst, color_dst, out, color_out, offsets, chunk_counts](const size_t b, const size_t e) {
+				for (size_t c=b; c<e; ++c) {
+					std::memcpy(out + offsets[c], dst + c * PACK_GRAIN, chunk_counts[c] * sizeof(Instance));
+					if (color_out) std::memcpy(color_out + offsets[c], color_dst + c * PACK_GRAIN, chunk_counts[c] * sizeof(uint32_t));
+				}
+			});
+		}
+		if (mColors && !colors) std::fill(mColorStaging.begin() + kept, mColorStaging.begin() + kept + span_count, RGBA8_WHITE);
+
+		kept += span_count;
+		start += count;
+	}
+	if (thinning) mDensity.end();
+
+	// The impostors go after everything else. There's room, since each
+	// stands in for at least one instance that was taken out.
+	size_t						impostors = 0;
+	if (clustering) {
+		mClusters.end();
+		const std::vector<Instance>&	imp(mClusters.getImpostors());
+		impostors = imp.size();
+		if (impostors > 0) std::memcpy(mStaging.data() + kept, imp.data(), impostors * sizeof(Instance));
+		if (mColors && impostors > 0) std::memcpy(mColorStaging.data() + kept, mClusters.getImpostorColors().data(), impostors * sizeof(uint32_t));
+	}
+	mStaging.resize(kept + impostors);
+	if (mColors) mColorStaging.resize(kept + impostors);
+	mStats.mPacked = size;
+	mStats.mCulled = size - visible;
+	mStats.mThinned = visible - unthinned;
+	mStats.mClustered = (clustering ? mClusters.getTaken() - impostors : 0);
+	mStats.mImpostors = impostors;
+}
+
+void ParticleRender::submit() {
+	mSubmitted = 0;
+	if (!mGlsl) return;
+	ci::gl::ScopedTextureBind	stb(mTexture);
+	// Prevent writing to the depth buffer, which will block out
+	// pixels that are supposed to be transparent.
+	ci::gl::ScopedDepthWrite	sdw(false);
+	// With colors, alpha accumulates as plain coverage, so the composite
+	// can divide it back out of the color.
+	ci::gl::ScopedBlend			sb(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, mColors ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// Points are sized by the vertex shader. ES always lets them be.
+#if ! defined( CINDER_GL_ES )
+	ci::gl::ScopedState			sps(GL_PROGRAM_POINT_SIZE, mPoints);
+#endif
+	ci::gl::color(1.0f, 1.0f, 1.0f, 1.0f);
+
+	submitCurves();
+	// Instances are unpacked against the bounds they were packed with.
+	const kt::math::Cube&		bounds(mPacker.getBounds());
+	const ci::gl::GlslProgRef&	glsl(instanceGlsl());
+	glsl->uniform("uNearLL", bounds.mNearLL);
+	glsl->uniform("uNearUR", bounds.mNearUR);
+	glsl->uniform("uFarLL", bounds.mFarLL);
+	glsl->uniform("uFarUR", bounds.mFarUR);
+	setSizeUniforms(*glsl);
+	if (mStaging.empty()) return;
+	mSubmitted += mStaging.size();
+	if (mPersistent && (mStaging.size() <= mRingCapacity || reserveRing(mStaging.size()))) {
+		submitRing();
+		return;
+	}
+
+	// Everything goes up in one map, and down in one draw.
+	if (mStaging.size() > mBufferCapacity) reserveBuffer(mStaging.size() + mStaging.size() / 2);
+	const size_t				count = mStaging.size();
+	char*						data = static_cast<char*>(mInstanceDataVbo->mapReplace());
+	std::memcpy(data, mStaging.data(), count * sizeof(Instance));
+	if (mColors) std::memcpy(data + mBufferCapacity * sizeof(Instance), mColorStaging.data(), count * sizeof(uint32_t));
+	mInstanceDataVbo->unmap();
+	if (mPoints) mBatch->draw(0, static_cast<GLsizei>(count));
+	else mBatch->drawInstanced(static_cast<GLsizei>(count));
+}
+
+void ParticleRender::packCurves(const ParticleList &particles) {
+	mCurveStaging.resize(particles.size());
+	const Particle*				src = particles.data();
+	CurveInstance*				dst = mCurveStaging.data();
+	kt::async::parallel_for(0, particles.size(), PACK_GRAIN, [src, dst](const size_t b, const size_t e) {
+		for (size_t k=b; k<e; ++k) {
+			const Particle&		p(src[k]);
+			CurveInstance&		c(dst[k]);
+			c.mP0 = glm::vec4(p.mCurve.mP0, p.mStartAlpha);
+			c.mP1 = glm::vec4(p.mCurve.mP1, p.mEndAlpha);
+			c.mP2 = p.mCurve.mP2;
+			c.mP3 = p.mCurve.mP3;
+			c.mStartColor = p.mStartColor;
+			c.mEndColor = p.mEndColor;
+		}
+	});
+	mCurvesDirty = true;
+}
+
+void ParticleRender::clearCurves() {
+	mCurveStaging.clear();
+	mCurvesDirty = true;
+}
+
+ci::gl::VboMeshRef ParticleRender::makeMesh() const {
 	// Create the mesh
 	const glm::vec2			tc_ul(0.0f, 0.0f),
 							tc_ur(1.0f, 0.0f),
 							tc_lr(1.0f, 1.0f),
 							tc_ll(0.0f, 1.0f);
-	const float				hs = cns.mParticleSize.x/2.0f;
+	const float				hs = mCns.mParticleSize.x/2.0f;
 	ci::gl::VboMeshRef		mesh = ci::gl::VboMesh::create(ci::geom::Rect(ci::Rectf(-hs, -hs, hs, hs)).texCoords(tc_ul, tc_ur, tc_lr, tc_ll));
 	if (!mesh) throw std::runtime_error("ParticleRender vbo can't create vbo mesh");
+	return mesh;
+}
 
-	// create an array of per-instance positions
-	std::vector<glm::vec4>	data;
-	data.resize(BUFFER_SIZE);
+ci::gl::BatchRef ParticleRender::makeBatch(const ci::gl::VboRef &instances, const size_t count) const {
+	const size_t			color_offset = count * sizeof(Instance);
+	if (mPoints) {
+		// Every instance is a vertex.
+		ci::geom::BufferLayout	layout;
+		layout.append(ci::geom::Attrib::CUSTOM_0, ci::geom::DataType::INTEGER, 2, sizeof(Instance), 0);
+		if (mColors) layout.append(ci::geom::Attrib::CUSTOM_1, ci::geom::DataType::INTEGER, 1, sizeof(uint32_t), color_offset);
+		ci::gl::VboMeshRef		points = ci::gl::VboMesh::create(static_cast<uint32_t>(count), GL_POINTS, { { layout, instances } });
+		if (!points) throw std::runtime_error("ParticleRender can't create point mesh");
+		if (!mColors) return ci::gl::Batch::create( points, mPointGlsl, { { ci::geom::Attrib::CUSTOM_0, "vInstance" } } );
+		return ci::gl::Batch::create( points, mPointGlsl, {	{ ci::geom::Attrib::CUSTOM_0, "vInstance" },
+															{ ci::geom::Attrib::CUSTOM_1, "vColor" } } );
+	}
 
-	// create the VBO which will contain per-instance (rather than per-vertex) data
-	mInstanceDataVbo = ci::gl::Vbo::create( GL_ARRAY_BUFFER, data.size() * sizeof(glm::vec4), data.data(), GL_DYNAMIC_DRAW );
+	ci::gl::VboMeshRef		mesh = makeMesh();
 
 	// we need a geom::BufferLayout to describe this data as mapping to the CUSTOM_0 semantic, and the 1 (rather than 0) as the last param indicates per-instance (rather than per-vertex)
+	// Each instance is read as two ints, and unpacked in the shader.
 	ci::geom::BufferLayout instanceDataLayout;
-	instanceDataLayout.append(ci::geom::Attrib::CUSTOM_0, 4, 0, 0, 1 /* per instance */ );
+	instanceDataLayout.append(ci::geom::Attrib::CUSTOM_0, ci::geom::DataType::INTEGER, 2, sizeof(Instance), 0, 1 /* per instance */ );
+	// Colors are one int each, from their own array.
+	if (mColors) instanceDataLayout.append(ci::geom::Attrib::CUSTOM_1, ci::geom::DataType::INTEGER, 1, sizeof(uint32_t), color_offset, 1);
 	
 	// now add it to the VboMesh we already made of the Teapot
-	mesh->appendVbo( instanceDataLayout, mInstanceDataVbo );
+	mesh->appendVbo( instanceDataLayout, instances );
 
-	// and finally, build our batch, mapping our CUSTOM_0 attribute to the "vInstancePosition" GLSL vertex attribute
-	mBatch = ci::gl::Batch::create( mesh, mGlsl, { { ci::geom::Attrib::CUSTOM_0, "vInstancePosition" } } );
+	// and finally, build our batch, mapping our CUSTOM_0 attribute to the "vInstance" GLSL vertex attribute
+	if (!mColors) return ci::gl::Batch::create( mesh, mGlsl, { { ci::geom::Attrib::CUSTOM_0, "vInstance" } } );
+	return ci::gl::Batch::create( mesh, mGlsl, {	{ ci::geom::Attrib::CUSTOM_0, "vInstance" },
+													{ ci::geom::Attrib::CUSTOM_1, "vColor" } } );
 }
 
-void ParticleRender::drawParticles(const ParticleList &particles) {
-	ci::gl::ScopedTextureBind	stb(mTexture);
-	// Prevent writing to the depth buffer, which will block out
-	// pixels that are supposed to be transparent.
-	ci::gl::ScopedDepthWrite	sdw(false);
-	ci::gl::ScopedBlendAlpha	sba;
-	ci::gl::color(1.0f, 1.0f, 1.0f, 1.0f);
+size_t ParticleRender::instanceBytes() const {
+	return sizeof(Instance) + (mColors ? sizeof(uint32_t) : 0);
+}
 
-	size_t						k = 0, size = particles.size();
-	while (size >= BUFFER_SIZE) {
-		drawParticles(k, k + BUFFER_SIZE, particles);
-		k += BUFFER_SIZE;
-		size -= BUFFER_SIZE;
+void ParticleRender::reserveBuffer(const size_t count) {
+	// Colors follow the instances, so the layout moves with the size.
+	mInstanceDataVbo = ci::gl::Vbo::create( GL_ARRAY_BUFFER, count * instanceBytes(), nullptr, GL_DYNAMIC_DRAW );
+	mBatch = makeBatch(mInstanceDataVbo, count);
+	mBufferCapacity = count;
+}
+
+void ParticleRender::submitRing() {
+#if ! defined( CINDER_GL_ES )
+	if (mStaging.empty()) return;
+
+	// Wait until the GPU is done with the frame that last used this region.
+	// With three regions that's normally long past.
+	GLsync&						fence(mRingFences[mRingRegion]);
+	wait_fence(fence);
+
+	const size_t				base = mRingRegion * mRingCapacity;
+	std::memcpy(mRingData + base, mStaging.data(), mStaging.size() * sizeof(Instance));
+	if (mColors) std::memcpy(mRingColors + base, mColorStaging.data(), mColorStaging.size() * sizeof(uint32_t));
+
+	// Every list shares the region, and one draw from its offset.
+	ci::gl::VboMeshRef			mesh = mRingBatch->getVboMesh();
+	ci::gl::ScopedVao			svao(mRingBatch->getVao());
+	ci::gl::ScopedGlslProg		sglsl(mRingBatch->getGlslProg());
+	ci::gl::setDefaultShaderVars();
+	const GLsizei				count = static_cast<GLsizei>(mStaging.size());
+	const GLuint				first = static_cast<GLuint>(base);
+	if (mPoints) {
+		glDrawArrays(GL_POINTS, static_cast<GLint>(first), count);
+	} else if (mesh->getNumIndices() > 0) {
+		glDrawElementsInstancedBaseInstance(mesh->getGlPrimitive(), mesh->getNumIndices(), mesh->getIndexDataType(), nullptr, count, first);
+	} else {
+		glDrawArraysInstancedBaseInstance(mesh->getGlPrimitive(), 0, mesh->getNumVertices(), count, first);
 	}
-	drawParticles(k, particles.size(), particles);
-}
-
-void ParticleRender::drawParticles(size_t start, size_t end, const ParticleList &particles) {
-	if (start >= particles.size()) return;
-	if (end > particles.size()) end = particles.size();
-
-	// update our instance positions; map our instance data VBO, write new positions, unmap
-	glm::vec4 *data = (glm::vec4*)mInstanceDataVbo->mapReplace();
-	for (size_t k=start; k<end; ++k) {
-		const Particle&			p(particles[k]);
-		data->x = p.mPosition.x;
-		data->y = p.mPosition.y;
-		data->z = p.mPosition.z;
-		data->w = p.mAlpha;
-		*data++;
+
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	mRingRegion = (mRingRegion + 1) % RING_FRAMES;
+#endif
+}
+
+void ParticleRender::submitCurves() {
+	if (mCurveStaging.empty() && !mCurveBatch) return;
+
+	if (!mCurveBatch) {
+		auto glsl = ProgramCache::shared().load("$(DATA)/shaders/particle_curve.vert", "$(DATA)/shaders/particle_instanced.frag");
+		if (!glsl) throw std::runtime_error("ParticleRender can't create curve shader");
+
+		ci::gl::VboMeshRef		mesh = makeMesh();
+
+		mCurveVbo = ci::gl::Vbo::create(GL_ARRAY_BUFFER, sizeof(CurveInstance), nullptr, GL_STATIC_DRAW);
+		const size_t			stride = sizeof(CurveInstance);
+		ci::geom::BufferLayout	layout;
+		layout.append(ci::geom::Attrib::CUSTOM_0, 4, stride, offsetof(CurveInstance, mP0), 1);
+		layout.append(ci::geom::Attrib::CUSTOM_1, 4, stride, offsetof(CurveInstance, mP1), 1);
+		layout.append(ci::geom::Attrib::CUSTOM_2, 3, stride, offsetof(CurveInstance, mP2), 1);
+		layout.append(ci::geom::Attrib::CUSTOM_3, 3, stride, offsetof(CurveInstance, mP3), 1);
+		layout.append(ci::geom::Attrib::CUSTOM_4, ci::geom::DataType::INTEGER, 2, stride, offsetof(CurveInstance, mStartColor), 1);
+		mesh->appendVbo(layout, mCurveVbo);
+		mCurveBatch = ci::gl::Batch::create(mesh, glsl, {	{ ci::geom::Attrib::CUSTOM_0, "aP0" },
+															{ ci::geom::Attrib::CUSTOM_1, "aP1" },
+															{ ci::geom::Attrib::CUSTOM_2, "aP2" },
+															{ ci::geom::Attrib::CUSTOM_3, "aP3" },
+															{ ci::geom::Attrib::CUSTOM_4, "aColors" } } );
+		glsl->uniform("uRangeZ", glm::vec2(mSettings.mRangeZ.mMin, mSettings.mRangeZ.mMax));
+		glsl->uniform("uColored", mColors ? 1 : 0);
 	}
-	mInstanceDataVbo->unmap();
 
-	// and draw
-	mBatch->drawInstanced(end-start);
+	// Only uploaded when there are new curves.
+	if (mCurvesDirty) {
+		const size_t			bytes = mCurveStaging.size() * sizeof(CurveInstance);
+		if (bytes > mCurveVbo->getSize()) mCurveVbo->bufferData(bytes, mCurveStaging.data(), GL_STATIC_DRAW);
+		else if (bytes > 0) mCurveVbo->bufferSubData(0, bytes, mCurveStaging.data());
+		mCurvesDirty = false;
+	}
+	if (mCurveStaging.empty()) return;
+
+	mCurveBatch->getGlslProg()->uniform("uCurveT", mCurveT);
+	setSizeUniforms(*mCurveBatch->getGlslProg());
+	mCurveBatch->drawInstanced(static_cast<GLsizei>(mCurveStaging.size()));
+	mSubmitted += mCurveStaging.size();
+}
+
+void ParticleRender::setSizeUniforms(ci::gl::GlslProg &glsl) const {
+	// Only a scaled down buffer needs particles grown; at full size they
+	// draw as they always have.
+	const std::pair<glm::ivec2, glm::ivec2>	vp = ci::gl::getViewport();
+	glsl.uniform("uParticleSize", mCns.mParticleSize.x);
+	glsl.uniform("uViewportHeight", static_cast<float>(vp.second.y));
+	glsl.uniform("uMinPixels", mRenderScale < 1.0f ? MIN_PIXELS : 0.0f);
+}
+
+bool ParticleRender::reserveRing(const size_t count) {
+	releaseRing();
+#if defined( CINDER_GL_ES )
+	mPersistent = false;
+	return false;
+#else
+
+	// Room for everything the settings ask for, with some slack for them growing.
+	size_t						capacity = mSettings.mParticleCount + mSettings.mAccentParticleCount;
+	if (capacity < count) capacity = count + count / 2;
+	// Instances for every region, then colors for every region.
+	const size_t				color_offset = capacity * RING_FRAMES * sizeof(Instance);
+	const GLsizeiptr			bytes = static_cast<GLsizeiptr>(capacity * RING_FRAMES * instanceBytes());
+	const GLbitfield			flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	mRingVbo = ci::gl::Vbo::create(GL_ARRAY_BUFFER);
+	if (mRingVbo) {
+		ci::gl::ScopedBuffer	sb(mRingVbo);
+		glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+		mRingData = static_cast<Instance*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+	}
+	if (!mRingData) {
+		releaseRing();
+		mPersistent = false;
+		return false;
+	}
+	mRingColors = (mColors ? reinterpret_cast<uint32_t*>(reinterpret_cast<char*>(mRingData) + color_offset) : nullptr);
+	mRingBatch = makeBatch(mRingVbo, capacity * RING_FRAMES);
+	mRingCapacity = capacity;
+	mRingRegion = 0;
+	return true;
+#endif
+}
+
+void ParticleRender::releaseRing() {
+#if ! defined( CINDER_GL_ES )
+	// Nothing can still be reading the buffer when it goes.
+	for (size_t k=0; k<RING_FRAMES; ++k) {
+		wait_fence(mRingFences[k]);
+	}
+#endif
+	// Deleting the buffer unmaps it.
+	mRingBatch.reset();
+	mRingVbo.reset();
+	mRingData = nullptr;
+	mRingColors = nullptr;
+	mRingCapacity = 0;
 }
 
 namespace {
 
+#if ! defined( CINDER_GL_ES )
+/**
+ * @func wait_fence
+ */
+void				wait_fence(GLsync &fence) {
+	if (!fence) return;
+	// Flush on the first wait, in case the fence hasn't been submitted yet.
+	GLbitfield					flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (true) {
+		const GLenum			r = glClientWaitSync(fence, flags, FENCE_TIMEOUT_NS);
+		if (r != GL_TIMEOUT_EXPIRED) break;
+		flags = 0;
+	}
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+#endif
+
 /**
- * @func make_texture
+ * @func make_jot
  */
-ci::gl::TextureRef	make_texture(const kt::Cns &cns) {
-	ci::Surface8u				src(cns.mCellSizeInPixelsRaw.x, cns.mCellSizeInPixelsRaw.y, true);
+ci::Surface8u		make_jot(const glm::vec2 &cell_size) {
+	ci::Surface8u				src(static_cast<int32_t>(cell_size.x), static_cast<int32_t>(cell_size.y), true);
 	auto						pit(src.getIter());
 	const glm::vec2				cen(static_cast<float>(src.getWidth()) / 2.0f, static_cast<float>(src.getHeight()) / 2.0f);
 	const float					r = fminf(cen.x, cen.y);
@@ -129,7 +561,7 @@ ci::gl::TextureRef	make_texture(const kt::Cns &cns) {
 			pit.a() = a;
 		}
 	}
-	return ci::gl::Texture::create(src);
+	return src;
 }
 
 }
@@ -3,7 +3,12 @@
 
 #include <cinder/gl/Batch.h>
 #include <cinder/gl/Texture.h>
+#include <cinder/Surface.h>
+#include "kt/async/task.h"
+#include "instance_packer.h"
+#include "cluster_lod.h"
 #include "particle_list.h"
+#include "tile_density.h"
 
 namespace kt { class Cns; }
 namespace cs {
@@ -12,26 +17,216 @@ class Settings;
 /**
  * @class cs::ParticleRender
  * @brief Draw all particles.
+ * @description Drawing is split in two: pack() quantizes particles to 8 byte
+ * instances in CPU memory and touches no GL, so it can run on any thread;
+ * submit() uploads the packed instances and draws them, on the GL thread.
+ *
+ * Where the driver supports it (GL 4.4, or ARB_buffer_storage and
+ * ARB_base_instance) instances go through a persistently mapped ring, one
+ * region per frame in flight: each frame is copied in once and drawn
+ * straight from its offset, with a fence keeping me from writing a region
+ * the GPU is still reading. Otherwise a single buffer, grown to fit, is
+ * remapped each frame. Either way every list packed together goes up in
+ * one copy and down in one instanced draw, under one set of state.
+ *
+ * The main particles can also be drawn from their curves: packCurves()
+ * stages every particle's curve and alphas once per transition, and the
+ * vertex shader evaluates them at the t given to setCurveT(), so all that
+ * changes from frame to frame is one uniform.
+ *
+ * Unless the settings say otherwise, packing culls anything off screen or
+ * too faint to see, and compacts the rest, so they're never uploaded. It
+ * can also thin out screen tiles the saturate pass will clamp anyway, and
+ * merge clusters of far instances into impostors, which the vertex shaders
+ * draw as large as their instance's size says.
+ *
+ * With setColors(), every instance also gets its particle's packed RGBA8
+ * color. Colors sit in their own array after the instances, in the same
+ * buffer, so the 8 byte instances are untouched and nothing is sent for
+ * them when colors are off.
+ *
+ * With setPoints(), each instance is one GL_POINTS vertex instead of an
+ * instanced quad, sized in the vertex shader and shaded with the jot's
+ * falloff in the fragment shader, so there are a quarter of the vertices
+ * and no texture. Curves are still drawn as quads.
  */
 class ParticleRender {
 public:
 	ParticleRender() = delete;
 	ParticleRender(const ParticleRender&) = delete;
 	ParticleRender(const kt::Cns&, const cs::Settings&);
+	~ParticleRender();
 
+	// Create the GL objects, waiting on the jot image if it isn't ready.
+	// Until this is called, submit() draws nothing. Call on the GL thread,
+	// before setColors() and setPoints().
+	void						setup();
+
+	// Pack and submit in one go.
 	void						drawParticles(const ParticleList&);
 
+	// Draw instances in their colors, or white. Call on the GL thread.
+	void						setColors(const bool);
+	// Draw instances as point sprites, or quads. Call on the GL thread.
+	void						setPoints(const bool);
+
+	// Somewhere to pack from: count positions, each followed by an alpha,
+	// stride bytes apart, and optionally their packed colors and ids.
+	// Without colors they're white. Ids only matter for thinning, which
+	// has to know a particle from one frame to the next; without them, a
+	// particle is known by its place in the source.
+	class Source {
+	public:
+		Source() { }
+		Source(const float *data, const size_t stride, const size_t count) : mData(data), mStride(stride), mCount(count) { }
+		Source(	const float *data, const size_t stride, const size_t count,
+				const uint32_t *colors, const size_t color_stride)
+				: mData(data), mStride(stride), mCount(count), mColors(colors), mColorStride(color_stride) { }
+		Source(	const float *data, const size_t stride, const size_t count,
+				const uint32_t *colors, const size_t color_stride,
+				const uint32_t *ids, const size_t id_stride)
+				: mData(data), mStride(stride), mCount(count), mColors(colors), mColorStride(color_stride)
+				, mIds(ids), mIdStride(id_stride) { }
+
+		const float*			mData = nullptr;
+		size_t					mStride = 0,
+								mCount = 0;
+		const uint32_t*			mColors = nullptr;
+		size_t					mColorStride = 0;
+		const uint32_t*			mIds = nullptr;
+		size_t					mIdStride = 0;
+	};
+
+	// A source for the list's particles, known by their mId if ids is
+	// true, otherwise by their place.
+	static Source				sourceFor(const ParticleList&, const bool ids = false);
+
+	// Replace the staged instances with each list's, in order. They're
+	// all drawn together.
+	void						pack(const std::vector<const ParticleList*>&);
+	void						pack(const std::vector<Source>&);
+	// Draw the staged instances.
+	void						submit();
+	// How many instances and curves the last submit() drew.
+	size_t						getSubmitted() const { return mSubmitted; }
+
+	// Replace the staged curves with the list's. Any thread, like pack().
+	void						packCurves(const ParticleList&);
+	void						clearCurves();
+	// Progress along the curves, before easing.
+	void						setCurveT(const float t) { mCurveT = t; }
+	// The size of the buffer I'm drawing into, relative to the window.
+	// Below 1, particles are grown to stay at least a pixel across.
+	void						setRenderScale(const float s) { mRenderScale = s; }
+
+	// Answer true if instances go through the persistent ring.
+	bool						isPersistent() const { return mPersistent; }
+
+	// What the last pack() did.
+	class Stats {
+	public:
+		Stats() { }
+
+		float					getCulledFraction() const { return mPacked > 0 ? static_cast<float>(mCulled) / static_cast<float>(mPacked) : 0.0f; }
+		float					getThinnedFraction() const { return mPacked > 0 ? static_cast<float>(mThinned) / static_cast<float>(mPacked) : 0.0f; }
+		float					getClusteredFraction() const { return mPacked > 0 ? static_cast<float>(mClustered) / static_cast<float>(mPacked) : 0.0f; }
+		size_t					getDrawn() const { return mPacked - mCulled - mThinned - mClustered; }
+
+		size_t					mPacked = 0,
+								mCulled = 0,
+		// Visible, but dropped from saturated tiles.
+								mThinned = 0,
+		// Visible, but merged into impostors, less the impostors.
+								mClustered = 0,
+								mImpostors = 0;
+	};
+	const Stats&				getStats() const { return mStats; }
+
 private:
-	void						drawParticles(size_t start, size_t end, const ParticleList&);
+	ci::gl::VboMeshRef			makeMesh() const;
+	// Draw a buffer of count instances, followed by their colors if I'm
+	// drawing them.
+	ci::gl::BatchRef			makeBatch(const ci::gl::VboRef &instances, const size_t count) const;
+	// The program for the instances, quads or points.
+	const ci::gl::GlslProgRef&	instanceGlsl() const { return mPoints ? mPointGlsl : mGlsl; }
+	// Answer the bytes each instance takes, including its color.
+	size_t						instanceBytes() const;
+	// Make room for count instances in the remapped buffer.
+	void						reserveBuffer(const size_t count);
+	void						submitRing();
+	// Make room for count instances per frame. Answer false if the ring
+	// can't be created, and fall back to remapping.
+	bool						reserveRing(const size_t count);
+	void						releaseRing();
+	void						submitCurves();
+	// The uniforms that keep particles a visible size in the current viewport.
+	void						setSizeUniforms(ci::gl::GlslProg&) const;
 
 	const kt::Cns&				mCns;
 	const cs::Settings&			mSettings;
 
+	// Starting size of the remapped buffer, in instances.
 	const size_t				BUFFER_SIZE = 10000;
+	// The bounds the staged instances were quantized to.
+	InstancePacker				mPacker;
+	std::vector<Instance>		mStaging;
+	bool						mColors = false;
+	std::vector<uint32_t>		mColorStaging;
+	// Compaction.
+	std::vector<Instance>		mScratch;
+	std::vector<uint32_t>		mColorScratch;
+	// The particle id of each scratch instance, for thinning.
+	std::vector<uint32_t>		mIdScratch;
+	std::vector<size_t>			mChunkCounts,
+								mChunkVisible,
+								mChunkUnthinned,
+								mChunkOffsets;
+	TileDensity					mDensity;
+	ClusterLod					mClusters;
+	Stats						mStats;
+	size_t						mSubmitted = 0;
 	ci::gl::VboRef				mInstanceDataVbo;
+	size_t						mBufferCapacity = 0;
 	ci::gl::TextureRef			mTexture;
+	kt::async::Task<ci::Surface8u>	mJot;
 	ci::gl::GlslProgRef			mGlsl;
+	bool						mPoints = false;
+	ci::gl::GlslProgRef			mPointGlsl;
 	ci::gl::BatchRef			mBatch;
+
+	// Persistent ring. Each of the frames in flight gets a region of
+	// mRingCapacity instances, and a fence for when the GPU is done with it.
+	static const size_t			RING_FRAMES = 3;
+	bool						mPersistent = false;
+	ci::gl::VboRef				mRingVbo;
+	ci::gl::BatchRef			mRingBatch;
+	Instance*					mRingData = nullptr;
+	uint32_t*					mRingColors = nullptr;
+	size_t						mRingCapacity = 0,
+								mRingRegion = 0;
+#if ! defined( CINDER_GL_ES )
+	GLsync						mRingFences[RING_FRAMES];
+#endif
+
+	// GPU curves. The alphas ride in the w of the first two points.
+	class CurveInstance {
+	public:
+		CurveInstance() { }
+
+		glm::vec4				mP0,
+								mP1;
+		glm::vec3				mP2,
+								mP3;
+		uint32_t				mStartColor,
+								mEndColor;
+	};
+	std::vector<CurveInstance>	mCurveStaging;
+	bool						mCurvesDirty = false;
+	float						mCurveT = 1.0f;
+	float						mRenderScale = 1.0f;
+	// Created the first time they're drawn.
+	ci::gl::VboRef				mCurveVbo;
+	ci::gl::BatchRef			mCurveBatch;
 };
 
 } // namespace cs
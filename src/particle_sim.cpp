@@ -0,0 +1,146 @@
+#include "particle_sim.h"
+
+#include "kt/async/thread_pool.h"
+#include "settings.h"
+
+namespace cs {
+
+namespace {
+// Particles per chunk when updating in parallel.
+const size_t		PARTICLE_GRAIN = 2048;
+// Accents are spawned every few steps.
+const size_t		ADD_ACCENT_TICKS = 5;
+
+// Blend each channel of two packed colors.
+inline uint32_t		mix_rgba8(const uint32_t a, const uint32_t b, const float t) {
+	if (a == b) return a;
+	const uint32_t		bt = static_cast<uint32_t>(t * 256.0f + 0.5f),
+						at = 256 - bt;
+	// Two channels at a time, with a byte of headroom between them.
+	const uint32_t		rb = ((a & 0x00ff00ff) * at + (b & 0x00ff00ff) * bt) >> 8,
+						ga = (((a >> 8) & 0x00ff00ff) * at + ((b >> 8) & 0x00ff00ff) * bt) >> 8;
+	return (rb & 0x00ff00ff) | ((ga & 0x00ff00ff) << 8);
+}
+
+// Move the particle to eased t along its curve. The vertex shader
+// for GPU curves does the same.
+inline void			evaluate(const float t, const kt::math::Rangef &range_z, Particle &p) {
+	static const kt::math::Rangef	FADE(0.1f, 1.0f);
+	p.mPosition = p.mCurve.point(t);
+	p.mAlpha = glm::mix(p.mStartAlpha, p.mEndAlpha, t);
+	p.mColor = mix_rgba8(p.mStartColor, p.mEndColor, t);
+
+	// Blur out a little based on distance
+	p.mAlpha *= range_z.convert(p.mPosition.z, FADE);
+}
+}
+
+/**
+ * @class cs::ParticleSim
+ */
+ParticleSim::ParticleSim(const cs::Settings &settings)
+		: mSettings(settings) {
+	// SETUP ACCENTS
+	mAccentForces.fill(128);
+}
+
+void ParticleSim::clear() {
+	mParticles.clear();
+	mAccentParticles.clear();
+	mStage = Stage::kHold;
+	mStageStart = mTransitionDuration = mHoldDuration = 0.0;
+	mCurveT = 1.0f;
+	mMoving = mFinished = false;
+	++mFrameVersion;
+}
+
+bool ParticleSim::wantsFrame(const double now) const {
+	return mStage == Stage::kHold && now - mStageStart >= mHoldDuration;
+}
+
+void ParticleSim::startTransition(const double now) {
+	mTransitionDuration = mParticles.mTransitionDuration;
+	mHoldDuration = mParticles.mHoldDuration;
+	mStage = Stage::kTransition;
+	mStageStart = now;
+	mCurveT = 0.0f;
+	++mFrameVersion;
+}
+
+void ParticleSim::updateStage(const double now) {
+	mMoving = mFinished = false;
+	if (mStage != Stage::kTransition) return;
+
+	const double			elapsed = now - mStageStart;
+	if (elapsed >= mTransitionDuration) {
+		mStage = Stage::kHold;
+		mStageStart = now;
+		mCurveT = 1.0f;
+		mFinished = true;
+	} else {
+		mMoving = true;
+		mCurveT = static_cast<float>(elapsed / mTransitionDuration);
+		mMoveT = static_cast<float>(kt::math::s_curved(elapsed / mTransitionDuration));
+	}
+}
+
+void ParticleSim::updateParticles() {
+	// On the GPU, the particles only need to land where the next frame starts.
+	float					t = mMoveT;
+	if (mGpuCurves) {
+		if (!mFinished) return;
+		t = 1.0f;
+	} else if (!mMoving) {
+		return;
+	}
+
+	const kt::math::Rangef&	range_z(mSettings.mRangeZ);
+	Particle*				particles = mParticles.data();
+	kt::async::parallel_for(0, mParticles.size(), PARTICLE_GRAIN, [particles, t, &range_z](const size_t b, const size_t e) {
+		for (size_t k=b; k<e; ++k) evaluate(t, range_z, particles[k]);
+	});
+}
+
+void ParticleSim::updateAccents() {
+	// Accents always fall down and fade out, with a little random forces thrown in.
+
+	for (auto& p : mAccentParticles) {
+		p.mAlpha -= 0.002f;
+		if (p.mAlpha <= 0.0f) {
+			std::swap(p, mAccentParticles.back());
+		} else {
+			p.mPosition.y += 0.04f;
+			// Apply forces.
+			glm::vec3		unit = mWorldBounds.toUnit(p.mPosition);
+			glm::vec3		force = mAccentForces.at(unit);
+			p.mPosition += (force * 0.00000000015f);
+		}
+	}
+	while (!mAccentParticles.empty() && mAccentParticles.back().mAlpha <= 0.0f) {
+		mAccentParticles.pop_back();
+	}
+}
+
+void ParticleSim::spawnAccents() {
+	// Accents are appended in order, so they're added after the particles move.
+	if (mMoving && mAddAccentTick == 0) {
+		for (const auto& p : mParticles) {
+			if (mAccentParticles.size() >= mSettings.mAccentParticleCount) break;
+			if (!p.mHasAccents) continue;
+			if (mGpuCurves) {
+				// Only the GPU knows where it is, so find out.
+				Particle		at(p);
+				evaluate(mMoveT, mSettings.mRangeZ, at);
+				mAccentParticles.push_back(Particle(at.mPosition, at.mAlpha * 0.25f, at.mColor));
+			} else {
+				mAccentParticles.push_back(Particle(p.mPosition, p.mAlpha * 0.25f, p.mColor));
+			}
+			mAccentParticles.back().mId = mNextAccentId++;
+		}
+	}
+
+	++mAddAccentTick;
+	if (mAddAccentTick >= ADD_ACCENT_TICKS) mAddAccentTick = 0;
+}
+
+} // namespace cs
@@ -0,0 +1,83 @@
+#ifndef CS_PARTICLESIM_H_
+#define CS_PARTICLESIM_H_
+
+#include <cstdint>
+#include "kt/math/geometry.h"
+#include "noise.h"
+#include "particle_list.h"
+
+namespace cs {
+class Settings;
+
+/**
+ * @class cs::ParticleSim
+ * @brief Move the particles along their curves, and the accents they leave behind.
+ * @description I don't know about threads or clocks; the caller supplies
+ * the time and the frames, so I can run on the render thread against the
+ * wall clock or on a thread of my own at a fixed tick. The steps can also
+ * run separately: updateStage() and updateParticles() touch only the main
+ * particles, updateAccents() only the accents, and spawnAccents() reads the
+ * particles and writes the accents.
+ */
+class ParticleSim {
+public:
+	ParticleSim() = delete;
+	ParticleSim(const ParticleSim&) = delete;
+	explicit ParticleSim(const cs::Settings&);
+
+	void						clear();
+	void						setWorldBounds(const kt::math::Cube &b) { mWorldBounds = b; }
+	// When the curves are evaluated on the GPU, I only move the particles
+	// when something on the CPU needs their positions: spawning accents,
+	// and the end of each transition, where the next frame starts.
+	void						setGpuCurves(const bool on) { mGpuCurves = on; }
+
+	// Answer true if the hold is over and I'm ready for the next frame.
+	bool						wantsFrame(const double now) const;
+	// The particles have a new frame; start moving through it.
+	void						startTransition(const double now);
+
+	// Advance the hold/transition stage to now.
+	void						updateStage(const double now);
+	// Move the particles along their curves.
+	void						updateParticles();
+	// Accents fall and fade.
+	void						updateAccents();
+	// Leave new accents behind the particles that have them.
+	void						spawnAccents();
+
+	// Changes whenever the particles get new curves.
+	uint64_t					getFrameVersion() const { return mFrameVersion; }
+	// Progress along the curves, before easing. 1 while holding.
+	float						getCurveT() const { return mCurveT; }
+
+	ParticleList&				getParticles() { return mParticles; }
+	const ParticleList&			getParticles() const { return mParticles; }
+	const ParticleList&			getAccents() const { return mAccentParticles; }
+
+private:
+	const cs::Settings&			mSettings;
+	kt::math::Cube				mWorldBounds;
+	ParticleList				mParticles;
+	ParticleList				mAccentParticles;
+	cs::InterpCube				mAccentForces;
+	size_t						mAddAccentTick = 0;
+	uint32_t					mNextAccentId = 0;
+	enum class Stage			{ kTransition, kHold };
+	Stage						mStage = Stage::kHold;
+	double						mStageStart = 0.0,
+								mTransitionDuration = 0.0,
+								mHoldDuration = 0.0;
+	bool						mGpuCurves = false;
+	uint64_t					mFrameVersion = 0;
+	float						mCurveT = 1.0f;
+	// Set by updateStage(): whether the particles move this step, and where
+	// to, and whether the transition just finished.
+	bool						mMoving = false,
+								mFinished = false;
+	float						mMoveT = 0.0f;
+};
+
+} // namespace cs
+
+#endif
@@ -1,5 +1,6 @@
 #include "particle_view.h"
 
+#include <algorithm>
 #include <cinder/gl/Batch.h>
 #include <cinder/gl/draw.h>
 #include <cinder/gl/gl.h>
@@ -8,11 +9,22 @@
 #include <cinder/ImageIo.h>
 #include "kt/app/kt_cns.h"
 #include "kt/app/kt_environment.h"
+#include "kt/async/thread_pool.h"
 #include "feeder.h"
 #include "settings.h"
 
 namespace cs {
 
+namespace {
+// Particles per chunk when interpolating in parallel.
+const size_t		PARTICLE_GRAIN = 4096;
+
+// Answer the colors, if there's one for each of count particles.
+inline const uint32_t*	colors_for(const std::vector<uint32_t> &colors, const size_t count) {
+	return (count > 0 && colors.size() == count ? colors.data() : nullptr);
+}
+}
+
 /**
  * @class cs::ParticleView
  */
@@ -20,87 +32,140 @@ ParticleView::ParticleView(const kt::Cns &cns, const cs::Settings &settings, Fee
 		: mCns(cns)
 		, mSettings(settings)
 		, mFeeder(f)
+		, mSim(settings)
 		, mRender(cns, settings) {
-	// SETUP ACCENTS
-	mAccentForces.fill(128);
 }
 
 void ParticleView::initializeParticles() {
 	// SETUP PARTICLES
-	mParticles.resize(mSettings.mParticleCount);
-	RandomGenerator			gen(RandomGenerator::Mode::kAnywhere);
-	gen.update(GeneratorParams(mCns), mParticles);
-	for (auto& p : mParticles) {
-		p.mPosition = p.mCurve.mP0 = p.mCurve.mP3;
-		p.mAlpha = p.mStartAlpha = p.mEndAlpha = 1.0f;
-	}
+	// The feeder seeds the particles on its worker; they arrive with the
+	// first frame. That's the longest part of startup, so it goes first,
+	// and the GL setup happens while it runs.
+	mSim.clear();
+	mSim.setGpuCurves(mSettings.mGpuCurves && !mSettings.mFixedRateSim);
+	mInbox.clear();
+	if (mSettings.mFixedRateSim && !mSimThread) mSimThread.reset(new SimThread(mSettings));
+	if (mSimThread) mSimThread->setWorldBounds(mCns.mWorldBounds);
+	mFeeder.start(mSettings.mParticleCount);
+
+	// SETUP RENDER
+	mRender.setup();
+	mRender.setColors(mSettings.mParticleColors);
+	mRender.setPoints(mSettings.mPointSprites);
+	mClock.start();
+}
 
-	mFeeder.start(mParticles);
+void ParticleView::invalidate() {
+	if (mSimThread) {
+		// The last frame sent to the sim is where it's headed.
+		mSimThread->setWorldBounds(mCns.mWorldBounds);
+		mFeeder.invalidate(mInbox);
+	} else {
+		mFeeder.invalidate(mSim.getParticles());
+	}
 }
 
 void ParticleView::update() {
 	updateAccents();
+	updateStage();
+	updateParticles();
+	spawnAccents();
+}
 
-	// Hold
-	if (mStage == Stage::kHold) {
-		if (mTimer.elapsed() >= mHoldDuration) {
-			if (mFeeder.hasFrame()) {
-				mFeeder.getFrame(mParticles);
-				mTransitionDuration = mParticles.mTransitionDuration;
-				mHoldDuration = mParticles.mHoldDuration;
-				mStage = Stage::kTransition;
-				mTimer.start();
-			}
-		}
-	// Transition
-	} else {
-		if (mTimer.elapsed() >= mTransitionDuration) {
-			mStage = Stage::kHold;
-			mTimer.start();
-		} else {
-			const float		t = static_cast<float>(kt::math::s_curved(mTimer.elapsed() / mTransitionDuration));
-			for (auto& p : mParticles) {
-				p.mPosition = p.mCurve.point(t);
-				p.mAlpha = glm::mix(p.mStartAlpha, p.mEndAlpha, t);
-
-				// Blur out a little based on distance
-				p.mAlpha *= mSettings.mRangeZ.convert(p.mPosition.z, kt::math::Rangef(0.1f, 1.0f));
-
-				if (mAddAccentTick == 0 && p.mHasAccents && mAccentParticles.size() < mSettings.mAccentParticleCount) {
-					mAccentParticles.push_back(Particle(p.mPosition, p.mAlpha * 0.25f));
-				}
-			}
+void ParticleView::draw() {
+	pack();
+	submit();
+}
+
+void ParticleView::updateStage() {
+	if (mSimThread) {
+		if (mSimThread->wantsFrame() && mFeeder.hasFrame()) {
+			mFeeder.getFrame(mInbox);
+			mSimThread->post(mInbox);
 		}
+		return;
 	}
 
-	static const size_t		ADD_ACCENT_TICKS = 5;
-	++mAddAccentTick;
-	if (mAddAccentTick >= ADD_ACCENT_TICKS) mAddAccentTick = 0;
+	const double			now = mClock.elapsed();
+	if (mSim.wantsFrame(now) && mFeeder.hasFrame()) {
+		mFeeder.getFrame(mSim.getParticles());
+		mSim.startTransition(now);
+	}
+	mSim.updateStage(now);
 }
 
-void ParticleView::draw() {
-	mRender.drawParticles(mParticles);
-	mRender.drawParticles(mAccentParticles);
+void ParticleView::updateParticles() {
+	if (!mSimThread) mSim.updateParticles();
 }
 
 void ParticleView::updateAccents() {
-	// Accents always fall down and fade out, with a little random forces thrown in.
-
-	for (auto& p : mAccentParticles) {
-		p.mAlpha -= 0.002f;
-		if (p.mAlpha <= 0.0f) {
-			std::swap(p, mAccentParticles.back());
-		} else {
-			p.mPosition.y += 0.04f;
-			// Apply forces.
-			glm::vec3		unit = mCns.mWorldBounds.toUnit(p.mPosition);
-			glm::vec3		force = mAccentForces.at(unit);
-			p.mPosition += (force * 0.00000000015f);
+	if (mSimThread) return;
+	mSim.setWorldBounds(mCns.mWorldBounds);
+	mSim.updateAccents();
+}
+
+void ParticleView::spawnAccents() {
+	if (!mSimThread) mSim.spawnAccents();
+}
+
+void ParticleView::pack() {
+	if (mSimThread) {
+		packSnapshots();
+		return;
+	}
+
+	// Accents die out of order, so they're known by their ids.
+	std::vector<ParticleRender::Source>	sources;
+	if (mSettings.mGpuCurves) {
+		// The curves only change with the frame; the shader does the rest.
+		if (mSim.getFrameVersion() != mCurveVersion) {
+			mRender.packCurves(mSim.getParticles());
+			mCurveVersion = mSim.getFrameVersion();
 		}
+		mRender.setCurveT(mSim.getCurveT());
+	} else {
+		sources.push_back(ParticleRender::sourceFor(mSim.getParticles()));
 	}
-	while (!mAccentParticles.empty() && mAccentParticles.back().mAlpha <= 0.0f) {
-		mAccentParticles.pop_back();
+	sources.push_back(ParticleRender::sourceFor(mSim.getAccents(), true));
+	mRender.pack(sources);
+}
+
+void ParticleView::submit(const float render_scale) {
+	mRender.setRenderScale(render_scale);
+	mRender.submit();
+}
+
+void ParticleView::packSnapshots() {
+	// Keep the last two ticks. The old previous goes back to the sim to reuse.
+	kt::async::TripleBuffer<SimThread::Snapshot>&	snapshots(mSimThread->getSnapshots());
+	if (snapshots.hasUpdate()) {
+		mPrevious.swap(snapshots.front());
+		snapshots.update();
 	}
+	const SimThread::Snapshot&	current(snapshots.front());
+
+	// Show the previous tick moving towards the current one, a tick behind
+	// the sim. Accents die out of order, so they aren't interpolated.
+	const std::chrono::duration<double>	since(std::chrono::steady_clock::now() - current.mTime);
+	const float				t = static_cast<float>(glm::clamp(since.count() / mSimThread->getTickSeconds(), 0.0, 1.0));
+	const bool				lerp = (mPrevious.mParticles.size() == current.mParticles.size());
+
+	const glm::vec4*		from = (lerp ? mPrevious.mParticles.data() : current.mParticles.data());
+	const glm::vec4*		to = current.mParticles.data();
+	mLerped.resize(current.mParticles.size());
+	glm::vec4*				dst = mLerped.data();
+	kt::async::parallel_for(0, current.mParticles.size(), PARTICLE_GRAIN, [dst, from, to, t](const size_t b, const size_t e) {
+		for (size_t k=b; k<e; ++k) dst[k] = glm::mix(from[k], to[k], t);
+	});
+
+	// Colors come from the current tick.
+	std::vector<ParticleRender::Source>	sources;
+	sources.push_back(ParticleRender::Source(	reinterpret_cast<const float*>(mLerped.data()), sizeof(glm::vec4), mLerped.size(),
+												colors_for(current.mColors, mLerped.size()), sizeof(uint32_t)));
+	sources.push_back(ParticleRender::Source(	reinterpret_cast<const float*>(current.mAccents.data()), sizeof(glm::vec4), current.mAccents.size(),
+												colors_for(current.mAccentColors, current.mAccents.size()), sizeof(uint32_t),
+												current.mAccentIds.data(), sizeof(uint32_t)));
+	mRender.pack(sources);
 }
 
 } // namespace cs
@@ -1,12 +1,15 @@
 #ifndef CS_PARTICLEVIEW_H_
 #define CS_PARTICLEVIEW_H_
 
+#include <memory>
 #include <cinder/gl/Batch.h>
+#include <cinder/Camera.h>
 #include <cinder/gl/Texture.h>
 #include "kt/time/seconds.h"
-#include "noise.h"
 #include "particle_list.h"
 #include "particle_render.h"
+#include "particle_sim.h"
+#include "sim_thread.h"
 
 namespace kt { class Cns; }
 namespace cs {
@@ -16,6 +19,20 @@ class Settings;
 /**
  * @class cs::ParticleView
  * @brief Update and draw all particles.
+ * @description update() and draw() run every stage in order. The stages are
+ * also available individually, for a scheduler that runs them concurrently:
+ * updateStage() and updateParticles() touch only the main particles, and
+ * updateAccents() only the accents, so those can overlap. spawnAccents()
+ * reads the main particles and writes the accents. pack() reads both and
+ * can run on any thread; submit() needs the GL thread.
+ *
+ * With a fixed rate sim, the sim runs on its own thread instead. The update
+ * stages just pass frames along, and pack() interpolates between the last
+ * two ticks the sim published.
+ *
+ * With GPU curves, the main particles' curves go to the render once per
+ * transition and are evaluated in the vertex shader. They don't apply to
+ * the fixed rate sim, which only publishes positions.
  */
 class ParticleView {
 public:
@@ -24,26 +41,48 @@ public:
 	ParticleView(const kt::Cns&, const cs::Settings&, Feeder&);
 
 	void						initializeParticles();
+	// The world bounds or particle count changed; regenerate for them.
+	void						invalidate();
 
 	void						update();
 	void						draw();
 
-private:
+	// Advance the hold/transition timer, taking the next frame when it's time.
+	void						updateStage();
+	// Move the particles along their curves.
+	void						updateParticles();
+	// Accents fall and fade.
 	void						updateAccents();
+	// Leave new accents behind the particles that have them.
+	void						spawnAccents();
+	void						pack();
+	// Draw into a buffer render_scale times the window size.
+	void						submit(const float render_scale = 1.0f);
+
+	// How many instances the last frame packed, and culled.
+	const ParticleRender::Stats&	getRenderStats() const { return mRender.getStats(); }
+	// How many instances and curves the last frame drew.
+	size_t						getSubmitted() const { return mRender.getSubmitted(); }
+	// Draw instances as point sprites, or quads. Call on the GL thread.
+	void						setPointSprites(const bool on) { mRender.setPoints(on); }
+
+private:
+	void						packSnapshots();
 
 	const kt::Cns&				mCns;
 	const cs::Settings&			mSettings;
 	class Feeder&				mFeeder;
-	Noise						mNoise;
-	ParticleList				mParticles;
-	ParticleList				mAccentParticles;
-	cs::InterpCube				mAccentForces;
-	size_t						mAddAccentTick = 0;
-	kt::time::Seconds			mTimer;
-	enum class Stage			{ kTransition, kHold };
-	Stage						mStage = Stage::kHold;
-	double						mTransitionDuration = 0.0,
-								mHoldDuration = 0.0;
+	kt::time::Seconds			mClock;
+	ParticleSim					mSim;
+	// The frame whose curves were last handed to the render.
+	uint64_t					mCurveVersion = 0;
+
+	// Fixed rate sim. Frames from the feeder pass through the inbox on
+	// their way to the sim thread.
+	std::unique_ptr<SimThread>	mSimThread;
+	ParticleList				mInbox;
+	SimThread::Snapshot			mPrevious;
+	std::vector<glm::vec4>		mLerped;
 
 	ParticleRender				mRender;
 };
@@ -0,0 +1,265 @@
+#include "program_cache.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <cinder/Cinder.h>
+#include <cinder/gl/gl.h>
+#include <cinder/Filesystem.h>
+#include "kt/app/kt_environment.h"
+
+// Loading a binary into a GlslProg leans on how Cinder 0.9 caches what a
+// program has. Any other Cinder compiles everything from source.
+#if defined( CINDER_VERSION ) && CINDER_VERSION >= 900 && CINDER_VERSION < 1000
+#define CS_PROGRAM_BINARIES		(1)
+#endif
+
+namespace cs {
+
+namespace {
+const char			MAGIC[8] = { 'C', 'S', 'P', 'R', 'O', 'G', 0, 0 };
+const uint32_t		VERSION = 1;
+
+#pragma pack(push, 1)
+struct FileHeader {
+	char			mMagic[8];
+	uint32_t		mVersion;
+	uint32_t		mFormat;
+	uint32_t		mLength;
+};
+#pragma pack(pop)
+
+
+std::once_flag		SHARED_ONCE;
+std::unique_ptr<ProgramCache>	SHARED;
+
+std::string			read_file(const std::string &path) {
+	std::ifstream	in(path, std::ios::binary);
+	if (!in) throw std::runtime_error("ProgramCache can't read " + path);
+	return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+std::string			gl_string(const GLenum name) {
+	const GLubyte*	s = glGetString(name);
+	return s ? std::string(reinterpret_cast<const char*>(s)) : std::string();
+}
+
+// Cinder binds this to location 0 unless told otherwise, so programs
+// linked here do too, to match.
+const char*			POSITION_ATTRIB = "ciPosition";
+
+#if defined( CS_PROGRAM_BINARIES )
+// A binary is loaded into a program made from these, which is cheap to
+// compile. They have no attributes or uniforms of their own.
+const char*			STUB_VERT = "#version 150\nvoid main( void ) { gl_Position = vec4( 0 ); }\n";
+const char*			STUB_FRAG = "#version 150\nout vec4 oColor;\nvoid main( void ) { oColor = vec4( 0 ); }\n";
+
+/**
+ * @class LinkedProg
+ * @brief A Cinder program loaded from a binary. Cinder has no way to make
+ * one, so this starts from the stub program, which has no attributes or
+ * uniforms, loads the binary over it, and has Cinder cache what it has now.
+ */
+class LinkedProg : public ci::gl::GlslProg {
+public:
+	LinkedProg() : GlslProg(Format().vertex(STUB_VERT).fragment(STUB_FRAG)) { }
+
+	// Answer false if the driver refuses the binary, which it can for one
+	// it made itself, after an update.
+	bool				load(const GLenum format, const std::vector<char> &blob) {
+		glProgramBinary(getHandle(), format, blob.data(), static_cast<GLsizei>(blob.size()));
+		GLint			linked = GL_FALSE;
+		glGetProgramiv(getHandle(), GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE) return false;
+		cacheActiveAttribs();
+		cacheActiveUniforms();
+#if ! defined( CINDER_GL_ES_2 )
+		cacheActiveUniformBlocks();
+#endif
+		return true;
+	}
+};
+#endif
+
+// Answer a compiled shader, or 0 if it doesn't compile.
+GLuint				compile_shader(const GLenum type, const std::string &src) {
+	const GLuint	shader = glCreateShader(type);
+	const GLchar*	text = src.c_str();
+	glShaderSource(shader, 1, &text, nullptr);
+	glCompileShader(shader);
+	GLint			compiled = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (compiled == GL_TRUE) return shader;
+	glDeleteShader(shader);
+	return 0;
+}
+
+// Link the sources once, keeping the binary for glGetProgramBinary() (some
+// drivers drop it otherwise), and answer it. Answer false if they don't
+// compile or link; the source compile reports why.
+bool				link_binary(const std::string &vert, const std::string &frag, GLenum &format, std::vector<char> &blob) {
+	const GLuint	vs = compile_shader(GL_VERTEX_SHADER, vert),
+					fs = (vs ? compile_shader(GL_FRAGMENT_SHADER, frag) : 0);
+	GLint			linked = GL_FALSE,
+					length = 0;
+	GLsizei			written = 0;
+	if (vs && fs) {
+		const GLuint	prog = glCreateProgram();
+		glAttachShader(prog, vs);
+		glAttachShader(prog, fs);
+		glBindAttribLocation(prog, 0, POSITION_ATTRIB);
+		glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(prog);
+		glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+		if (linked == GL_TRUE) glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length > 0) {
+			blob.resize(static_cast<size_t>(length));
+			glGetProgramBinary(prog, length, &written, &format, blob.data());
+		}
+		glDeleteProgram(prog);
+	}
+	if (vs) glDeleteShader(vs);
+	if (fs) glDeleteShader(fs);
+	blob.resize(static_cast<size_t>(written > 0 ? written : 0));
+	return !blob.empty();
+}
+
+// Answer a program made from a binary, or nullptr if the driver refuses it.
+ci::gl::GlslProgRef	wrap_binary(const GLenum format, const std::vector<char> &blob) {
+#if defined( CS_PROGRAM_BINARIES )
+	std::shared_ptr<LinkedProg>	prog(new LinkedProg());
+	if (prog->load(format, blob)) return prog;
+#endif
+	return nullptr;
+}
+
+// FNV-1a, 64 bit.
+uint64_t			hash(const std::string &s, uint64_t h) {
+	for (const auto& c : s) {
+		h ^= static_cast<uint8_t>(c);
+		h *= 0x100000001b3ull;
+	}
+	// Keep "ab" + "c" from hashing like "a" + "bc".
+	h ^= 0xff;
+	h *= 0x100000001b3ull;
+	return h;
+}
+}
+
+/**
+ * @class cs::ProgramCache
+ */
+ProgramCache::ProgramCache(const std::string &dir)
+		: mDir(dir) {
+}
+
+ProgramCache& ProgramCache::shared() {
+	std::call_once(SHARED_ONCE, []() { SHARED.reset(new ProgramCache(kt::env::expand("$(APP)/shader_cache"))); });
+	return *SHARED;
+}
+
+ci::gl::GlslProgRef ProgramCache::load(const std::string &vert_path, const std::string &frag_path) {
+	const auto				start = std::chrono::steady_clock::now();
+	const std::string		vert = read_file(kt::env::expand(vert_path)),
+							frag = read_file(kt::env::expand(frag_path));
+
+	const std::string		path = (isSupported() ? binaryPath(vert, frag) : std::string());
+	ci::gl::GlslProgRef		prog;
+	if (!path.empty()) prog = loadBinary(path);
+	if (prog) {
+		++mStats.mCached;
+	} else if (!path.empty()) {
+		// Linked once, and wrapped the way a cached binary is.
+		GLenum				format = 0;
+		std::vector<char>	blob;
+		if (link_binary(vert, frag, format, blob)) {
+			saveBinary(path, format, blob);
+			prog = wrap_binary(format, blob);
+		}
+	}
+	// Without a binary, this is how it always loaded. It also throws for
+	// sources that don't compile.
+	if (!prog) prog = ci::gl::GlslProg::create(ci::gl::GlslProg::Format().vertex(vert).fragment(frag));
+	++mStats.mLoaded;
+	mStats.mSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return prog;
+}
+
+bool ProgramCache::isSupported() {
+#if ! defined( CS_PROGRAM_BINARIES )
+	mSupport = Support::kNo;
+#endif
+	if (mSupport == Support::kUnknown) {
+		GLint				formats = 0;
+		const std::pair<GLint, GLint>	v = ci::gl::getVersion();
+		if (v.first > 4 || (v.first == 4 && v.second >= 1) || ci::gl::isExtensionAvailable("GL_ARB_get_program_binary")) {
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		mSupport = (formats > 0 && !mDir.empty() ? Support::kYes : Support::kNo);
+	}
+	return mSupport == Support::kYes;
+}
+
+std::string ProgramCache::binaryPath(const std::string &vert, const std::string &frag) const {
+	uint64_t				h = 0xcbf29ce484222325ull;
+	h = hash(vert, h);
+	h = hash(frag, h);
+	h = hash(gl_string(GL_VENDOR), h);
+	h = hash(gl_string(GL_RENDERER), h);
+	h = hash(gl_string(GL_VERSION), h);
+
+	std::ostringstream		name;
+	name << std::hex << std::setw(16) << std::setfill('0') << h << ".bin";
+	return (ci::fs::path(mDir) / name.str()).string();
+}
+
+ci::gl::GlslProgRef ProgramCache::loadBinary(const std::string &path) const {
+	std::ifstream			in(path, std::ios::binary);
+	if (!in) return nullptr;
+	FileHeader				h;
+	if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))) return nullptr;
+	if (std::memcmp(h.mMagic, MAGIC, sizeof(MAGIC)) != 0 || h.mVersion != VERSION || h.mLength < 1) return nullptr;
+	std::vector<char>		blob(h.mLength);
+	if (!in.read(blob.data(), blob.size())) return nullptr;
+
+	// A refused binary is replaced by the source compile.
+	return wrap_binary(static_cast<GLenum>(h.mFormat), blob);
+}
+
+void ProgramCache::saveBinary(const std::string &path, const GLenum format, const std::vector<char> &blob) const {
+	// Write beside, then swap in, so a crash never leaves half a binary.
+	try {
+		ci::fs::create_directories(ci::fs::path(mDir));
+	} catch (std::exception const&) {
+		return;
+	}
+	const std::string		tmp = path + ".tmp";
+	FileHeader				h;
+	std::memcpy(h.mMagic, MAGIC, sizeof(MAGIC));
+	h.mVersion = VERSION;
+	h.mFormat = static_cast<uint32_t>(format);
+	h.mLength = static_cast<uint32_t>(blob.size());
+	{
+		std::ofstream		out(tmp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		out.write(blob.data(), blob.size());
+		if (!out) {
+			out.close();
+			std::remove(tmp.c_str());
+			return;
+		}
+	}
+	std::remove(path.c_str());
+	std::rename(tmp.c_str(), path.c_str());
+}
+
+} // namespace cs
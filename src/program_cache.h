@@ -0,0 +1,68 @@
+#ifndef CS_PROGRAMCACHE_H_
+#define CS_PROGRAMCACHE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <cinder/gl/GlslProg.h>
+
+namespace cs {
+
+/**
+ * @class cs::ProgramCache
+ * @brief Load shader programs from the binaries of earlier runs.
+ * @description Each program's linked binary is saved under the cache
+ * directory, keyed by a hash of its sources and the GL vendor, renderer
+ * and version, so editing a shader or updating the driver misses the
+ * cache instead of loading something stale. Anything that can't come from
+ * the cache, for whatever reason, is compiled from source as before.
+ * A miss links once, saves the binary, and loads the program from it the
+ * way a hit does. Binaries need Cinder 0.9, the GlslProg it knows how to
+ * load one into; any other Cinder always compiles from source.
+ *
+ * GL thread only.
+ */
+class ProgramCache {
+public:
+	// Binaries go in dir, which is made as needed.
+	explicit ProgramCache(const std::string &dir);
+
+	static ProgramCache&	shared();
+
+	// Answer the program for the vertex and fragment shader files, which
+	// are expanded by kt::env. Throws like GlslProg::create() if they
+	// don't compile.
+	ci::gl::GlslProgRef		load(const std::string &vert_path, const std::string &frag_path);
+
+	// What load() has done so far.
+	class Stats {
+	public:
+		Stats() { }
+
+		size_t				mLoaded = 0,
+							mCached = 0;
+		double				mSeconds = 0.0;
+	};
+	const Stats&			getStats() const { return mStats; }
+
+private:
+	ProgramCache(const ProgramCache&);
+	ProgramCache&			operator=(const ProgramCache&);
+
+	// Answer true if the driver can hand out binaries. Needs a context.
+	bool					isSupported();
+	// Answer the file for these sources on this driver.
+	std::string				binaryPath(const std::string &vert, const std::string &frag) const;
+	// Answer nullptr if there's no usable binary.
+	ci::gl::GlslProgRef		loadBinary(const std::string &path) const;
+	void					saveBinary(const std::string &path, const GLenum format, const std::vector<char> &blob) const;
+
+	const std::string		mDir;
+	enum class Support		{ kUnknown, kYes, kNo };
+	Support					mSupport = Support::kUnknown;
+	Stats					mStats;
+};
+
+} // namespace cs
+
+#endif
@@ -0,0 +1,98 @@
+#include "settings.h"
+
+#include <cstdlib>
+
+namespace cs {
+
+/**
+ * @class cs::Settings
+ */
+void Settings::readArgs(const std::vector<std::string> &args) {
+	// The first arg is the app.
+	for (size_t k=1; k<args.size(); ++k) {
+		const std::string&		a(args[k]);
+		if ((a == "--bake" || a == "--play") && k+1 < args.size()) {
+			mShowMode = (a == "--bake" ? ShowMode::kBake : ShowMode::kPlay);
+			mShowPath = args[++k];
+			if (mShowMode == ShowMode::kBake && k+1 < args.size()) {
+				const long		frames = std::strtol(args[k+1].c_str(), nullptr, 10);
+				if (frames > 0) {
+					mShowFrames = static_cast<size_t>(frames);
+					++k;
+				}
+			}
+		} else if (a == "--check-packing") {
+			mCheckPacking = true;
+		} else if (a == "--compare-scale") {
+			mCompareScale = true;
+			mHeadless = true;
+			if (k+1 < args.size() && args[k+1].compare(0, 2, "--") != 0) mComparePath = args[++k];
+		} else if (a == "--benchmark-points") {
+			mBenchmarkPoints = true;
+			mHeadless = true;
+		} else if (a == "--gpu-curves") {
+			mGpuCurves = true;
+		} else if (a == "--colors") {
+			mParticleColors = true;
+		} else if (a == "--points") {
+			mPointSprites = true;
+		} else if (a == "--thin") {
+			mThinSaturated = true;
+			if (k+1 < args.size()) {
+				const double	budget = std::strtod(args[k+1].c_str(), nullptr);
+				if (budget > 0.0) {
+					mThinBudget = static_cast<float>(budget);
+					++k;
+				}
+			}
+		} else if (a == "--render-scale" && k+1 < args.size()) {
+			const double		scale = std::strtod(args[++k].c_str(), nullptr);
+			if (scale > 0.0) mRenderScale = static_cast<float>(scale < 1.0 ? scale : 1.0);
+		} else if (a == "--upscale" && k+1 < args.size()) {
+			mUpscale = (args[++k] == "bicubic" ? Upscale::kBicubic : Upscale::kBilinear);
+		} else if (a == "--cluster") {
+			mClusterFar = true;
+			if (k+1 < args.size()) {
+				const double	depth = std::strtod(args[k+1].c_str(), nullptr);
+				if (depth > 0.0 && depth <= 1.0) {
+					mClusterDepth = static_cast<float>(depth);
+					++k;
+				}
+			}
+		} else if (a == "--headless") {
+			mHeadless = true;
+			if (k+1 < args.size()) {
+				const long		frames = std::strtol(args[k+1].c_str(), nullptr, 10);
+				if (frames > 0) {
+					mHeadlessFrames = static_cast<size_t>(frames);
+					++k;
+				}
+			}
+		} else if (a == "--size" && k+2 < args.size()) {
+			const long			w = std::strtol(args[k+1].c_str(), nullptr, 10),
+								h = std::strtol(args[k+2].c_str(), nullptr, 10);
+			k += 2;
+			if (w > 0 && h > 0) mHeadlessSize = glm::ivec2(static_cast<int>(w), static_cast<int>(h));
+		} else if (a == "--dump" && k+1 < args.size()) {
+			mDumpPath = args[++k];
+			if (k+1 < args.size()) {
+				const long		every = std::strtol(args[k+1].c_str(), nullptr, 10);
+				if (every > 0) {
+					mDumpEvery = static_cast<size_t>(every);
+					++k;
+				}
+			}
+		} else if (a == "--sim") {
+			mFixedRateSim = true;
+			if (k+1 < args.size()) {
+				const double	rate = std::strtod(args[k+1].c_str(), nullptr);
+				if (rate > 0.0) {
+					mSimRate = rate;
+					++k;
+				}
+			}
+		}
+	}
+}
+
+} // namespace cs
@@ -1,7 +1,11 @@
 #ifndef CS_SETTINGS_H_
 #define CS_SETTINGS_H_
 
+#include <string>
+#include <vector>
 #include <cinder/Color.h>
+#include <cinder/Vector.h>
+#include "kt/async/thread_attributes.h"
 #include "kt/math/range.h"
 
 namespace cs {
@@ -14,7 +18,30 @@ namespace cs {
  */
 class Settings {
 public:
-	Settings() { }
+	Settings() {
+		// Generating is never as urgent as drawing.
+		mFeederThreads.mNice = 5;
+	}
+
+	// Apply any command line options:
+	//	--bake <path> [frames]	Bake a show to path, then quit.
+	//	--play <path>			Play a baked show instead of generating.
+	//	--sim [rate]			Run the sim on its own thread at a fixed rate.
+	//	--gpu-curves			Evaluate curves in the vertex shader.
+	//	--colors				Draw particles in their generated colors.
+	//	--thin [budget]			Thin out particles in saturated areas.
+	//	--render-scale <s>		Draw particles at s times the window size.
+	//	--upscale <filter>		Upscale with bilinear or bicubic.
+	//	--points				Draw particles as point sprites.
+	//	--cluster [depth]		Draw far particles as cluster impostors.
+	//	--check-packing			Check the instance precision, then quit.
+	//	--compare-scale [dir]	Compare the render scale to full size, then
+	//							quit. Saves both images to dir.
+	//	--benchmark-points		Time quads against point sprites, then quit.
+	//	--headless [frames]		Time a fixed run in a window, then quit.
+	//	--size <w> <h>			Run headless at w by h.
+	//	--dump <dir> [every]	Save every nth headless frame to dir.
+	void				readArgs(const std::vector<std::string>&);
 
 	// Total number of main particles
 	size_t				mParticleCount = 5000;
@@ -23,6 +50,92 @@ public:
 	// Total number of accent particles
 	size_t				mAccentParticleCount = 10000;
 
+	// Number of frames the feeder generates ahead of the view, and a cap (in
+	// bytes) on the memory those frames can use. The cap wins.
+	size_t				mFeederLookahead = 3;
+	size_t				mFeederMemoryCap = 256 * 1024 * 1024;
+	// Number of threads generating frames.
+	size_t				mFeederWorkers = 2;
+
+	// Run the particle sim on its own thread at mSimRate ticks per second,
+	// with the render interpolating between ticks, instead of once per frame.
+	bool				mFixedRateSim = false;
+	double				mSimRate = 60.0;
+
+	// Scheduling for the main (render) thread, the feeder workers, the
+	// shared pool (which also generates the background) and the sim thread.
+	// Pin the workers to other cores than the main thread to keep them from
+	// preempting it. Names are ignored; each thread names itself.
+	kt::async::ThreadAttributes	mMainThread,
+						mFeederThreads,
+						mPoolThreads,
+						mSimThread;
+	// Lock all memory into RAM, so nothing hot is paged out mid-show.
+	bool				mLockMemory = false;
+
+	// Live generates frames as they're needed. Bake generates mShowFrames
+	// frames to mShowPath and quits; play reads them back.
+	enum class ShowMode	{ kLive, kBake, kPlay };
+	ShowMode			mShowMode = ShowMode::kLive;
+	std::string			mShowPath;
+	size_t				mShowFrames = 200;
+
+	// Check how far packing moves points on screen, print it, and quit.
+	bool				mCheckPacking = false;
+	// Run headless to the first frame with particles, compare it drawn at
+	// mRenderScale to full size, print it, and quit. Both images are saved
+	// to mComparePath, if there is one; it's also where the compare key
+	// saves them.
+	bool				mCompareScale = false;
+	std::string			mComparePath;
+	// Run headless to the first frame with particles, time drawing them as
+	// quads and as point sprites, print it, and quit.
+	bool				mBenchmarkPoints = false;
+
+	// Draw instances from a persistently mapped ring, if the driver can.
+	bool				mPersistentInstances = true;
+	// Drop instances that are off screen or too faint to see before
+	// uploading them.
+	bool				mCullInstances = true;
+	// Drop some of the instances in screen tiles that were saturated last
+	// frame, keeping mThinBudget coverage (alpha times tiles covered) in
+	// each. The saturate pass clamps those tiles anyway.
+	bool				mThinSaturated = false;
+	float				mThinBudget = 2.0f;
+	// Merge the instances in the back mClusterDepth of mRangeZ into
+	// impostors, one per few particles wide cell, splitting as they get
+	// nearer.
+	bool				mClusterFar = false;
+	float				mClusterDepth = 0.25f;
+	// Evaluate the main particles' curves in the vertex shader. Ignored
+	// with a fixed rate sim.
+	bool				mGpuCurves = false;
+	// Draw each particle in the color its generator gave it, instead of
+	// white. Costs 4 bytes per instance.
+	bool				mParticleColors = false;
+	// Draw each instance as one point sprite instead of an instanced quad.
+	bool				mPointSprites = false;
+
+	// Draw the particles into a buffer mRenderScale times the window size,
+	// which the saturate pass scales back up. The look is soft anyway, so
+	// on large screens most of the fill is wasted. Particles are kept at
+	// least a buffer pixel across, so they don't sparkle.
+	float				mRenderScale = 1.0f;
+	enum class Upscale	{ kBilinear, kBicubic };
+	Upscale				mUpscale = Upscale::kBilinear;
+
+	// Run mHeadlessFrames frames in a mHeadlessSize window, as fast as they
+	// draw, then print the frame timings and quit. Frames count from the
+	// first with particles. Every mDumpEvery'th frame is saved to mDumpPath,
+	// if there is one; saving stalls the GPU, but isn't in the timings.
+	// Headless only means nobody has to watch: there's no offscreen context,
+	// the window is the render target, so a run still needs a display.
+	bool				mHeadless = false;
+	size_t				mHeadlessFrames = 300;
+	glm::ivec2			mHeadlessSize = glm::ivec2(1920, 1080);
+	std::string			mDumpPath;
+	size_t				mDumpEvery = 1;
+
 	// The far and near z planes that enclose the particles.
 	kt::math::Rangef	mRangeZ = kt::math::Rangef(-80.0f, 0.0f);
 
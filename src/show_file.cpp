@@ -0,0 +1,261 @@
+#include "show_file.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace cs {
+
+namespace {
+const char			MAGIC[8] = { 'C', 'S', 'S', 'H', 'O', 'W', 0, 0 };
+const uint32_t		VERSION = 1;
+const uint32_t		FRAME_KEY = 1<<0;
+const uint8_t		PARTICLE_ACCENTS = 1<<0;
+// Control points wander outside the world bounds, so quantize to a larger box.
+const float			BOX_EXPAND = 0.5f;
+
+#pragma pack(push, 1)
+struct FileHeader {
+	char			mMagic[8];
+	uint32_t		mVersion;
+	uint32_t		mParticleCount;
+	uint32_t		mFrameCount;
+	uint32_t		mFrameSize;
+	float			mMin[3], mSize[3];
+};
+
+struct FrameHeader {
+	uint32_t		mFlags;
+	float			mTransitionDuration, mHoldDuration;
+	float			mMaxCurveLength, mAverageCurveLength;
+	// Size of one step of the endpoint deltas, per axis.
+	float			mScale[3];
+};
+
+struct ParticleRecord {
+	// Key frames store unorm16 positions in the box; others store int16
+	// deltas from the previous endpoint.
+	uint16_t		mEnd[3];
+	uint16_t		mP1[3], mP2[3];
+	uint8_t			mEndAlpha;
+	uint8_t			mFlags;
+};
+#pragma pack(pop)
+
+size_t				frame_size(const size_t count) {
+	return sizeof(FrameHeader) + count * sizeof(ParticleRecord);
+}
+
+uint16_t			to_unorm16(const float v, const float min, const float size) {
+	float			u = (size > 0.0f ? (v - min) / size : 0.0f);
+	if (u < 0.0f) u = 0.0f;
+	else if (u > 1.0f) u = 1.0f;
+	return static_cast<uint16_t>(u * 65535.0f + 0.5f);
+}
+
+float				from_unorm16(const uint16_t q, const float min, const float size) {
+	return min + (static_cast<float>(q) / 65535.0f) * size;
+}
+
+void				to_unorm16(const glm::vec3 &v, const glm::vec3 &min, const glm::vec3 &size, uint16_t *out) {
+	for (int k=0; k<3; ++k) out[k] = to_unorm16(v[k], min[k], size[k]);
+}
+
+glm::vec3			from_unorm16(const uint16_t *q, const glm::vec3 &min, const glm::vec3 &size) {
+	return glm::vec3(	from_unorm16(q[0], min.x, size.x),
+						from_unorm16(q[1], min.y, size.y),
+						from_unorm16(q[2], min.z, size.z));
+}
+
+int16_t				to_delta(const float d, const float scale) {
+	float			q = std::floor(d / scale + 0.5f);
+	if (q < -32767.0f) q = -32767.0f;
+	else if (q > 32767.0f) q = 32767.0f;
+	return static_cast<int16_t>(q);
+}
+
+float				from_delta(const uint16_t q, const float scale) {
+	int16_t			d;
+	std::memcpy(&d, &q, sizeof(d));
+	return static_cast<float>(d) * scale;
+}
+
+uint8_t				to_unorm8(const float v) {
+	if (v <= 0.0f) return 0;
+	if (v >= 1.0f) return 255;
+	return static_cast<uint8_t>(v * 255.0f + 0.5f);
+}
+}
+
+/**
+ * @class cs::ShowWriter
+ */
+ShowWriter::ShowWriter(const std::string &path, const kt::math::Cube &bounds, const size_t count)
+		: mFile(path, std::ios::binary | std::ios::trunc)
+		, mCount(count) {
+	if (!mFile) throw std::runtime_error("ShowWriter can't open " + path);
+	if (count < 1) throw std::runtime_error("ShowWriter has no particles");
+
+	glm::vec3				min(bounds.mNearLL), max(bounds.mNearLL);
+	for (const auto& c : { bounds.mNearLL, bounds.mNearUR, bounds.mFarLL, bounds.mFarUR }) {
+		min = glm::min(min, c);
+		max = glm::max(max, c);
+	}
+	const glm::vec3			expand((max - min) * BOX_EXPAND);
+	mMin = min - expand;
+	mSize = (max + expand) - mMin;
+
+	// Written again with the frame count when finished.
+	FileHeader				h;
+	std::memcpy(h.mMagic, MAGIC, sizeof(MAGIC));
+	h.mVersion = VERSION;
+	h.mParticleCount = static_cast<uint32_t>(count);
+	h.mFrameCount = 0;
+	h.mFrameSize = static_cast<uint32_t>(frame_size(count));
+	for (int k=0; k<3; ++k) {
+		h.mMin[k] = mMin[k];
+		h.mSize[k] = mSize[k];
+	}
+	mFile.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	mBuffer.resize(frame_size(count));
+}
+
+ShowWriter::~ShowWriter() {
+	try {
+		close();
+	} catch (std::exception const&) {
+	}
+}
+
+void ShowWriter::write(const ParticleList &list) {
+	if (!mFile.is_open()) throw std::runtime_error("ShowWriter is closed");
+	if (list.size() != mCount) throw std::runtime_error("ShowWriter frame is the wrong size");
+
+	FrameHeader&			fh(*reinterpret_cast<FrameHeader*>(&mBuffer.front()));
+	ParticleRecord*			rec = reinterpret_cast<ParticleRecord*>(&mBuffer.front() + sizeof(FrameHeader));
+	const bool				key = mEnd.empty();
+
+	fh.mFlags = (key ? FRAME_KEY : 0);
+	fh.mTransitionDuration = static_cast<float>(list.mTransitionDuration);
+	fh.mHoldDuration = static_cast<float>(list.mHoldDuration);
+	fh.mMaxCurveLength = list.mMaxCurveLength;
+	fh.mAverageCurveLength = list.mAverageCurveLength;
+
+	// Size the delta steps so the largest move just fits.
+	glm::vec3				scale(1.0f);
+	if (!key) {
+		glm::vec3			max_d(0.0f);
+		for (size_t k=0; k<mCount; ++k) {
+			max_d = glm::max(max_d, glm::abs(list[k].mCurve.mP3 - mEnd[k]));
+		}
+		for (int k=0; k<3; ++k) {
+			if (max_d[k] > 0.0f) scale[k] = max_d[k] / 32767.0f;
+		}
+	}
+	for (int k=0; k<3; ++k) fh.mScale[k] = scale[k];
+
+	mEnd.resize(mCount);
+	for (size_t k=0; k<mCount; ++k) {
+		const Particle&		p(list[k]);
+		ParticleRecord&		r(rec[k]);
+		if (key) {
+			to_unorm16(p.mCurve.mP3, mMin, mSize, r.mEnd);
+			mEnd[k] = from_unorm16(r.mEnd, mMin, mSize);
+		} else {
+			for (int j=0; j<3; ++j) {
+				const int16_t	d = to_delta(p.mCurve.mP3[j] - mEnd[k][j], scale[j]);
+				std::memcpy(&r.mEnd[j], &d, sizeof(d));
+				mEnd[k][j] += from_delta(r.mEnd[j], scale[j]);
+			}
+		}
+		to_unorm16(p.mCurve.mP1, mMin, mSize, r.mP1);
+		to_unorm16(p.mCurve.mP2, mMin, mSize, r.mP2);
+		r.mEndAlpha = to_unorm8(p.mEndAlpha);
+		r.mFlags = (p.mHasAccents ? PARTICLE_ACCENTS : 0);
+	}
+
+	mFile.write(reinterpret_cast<const char*>(&mBuffer.front()), mBuffer.size());
+	if (!mFile) throw std::runtime_error("ShowWriter can't write frame");
+	++mFrames;
+}
+
+void ShowWriter::close() {
+	if (!mFile.is_open()) return;
+
+	const uint32_t			frames = static_cast<uint32_t>(mFrames);
+	mFile.seekp(offsetof(FileHeader, mFrameCount));
+	mFile.write(reinterpret_cast<const char*>(&frames), sizeof(frames));
+	const bool				good = mFile.good();
+	mFile.close();
+	if (!good) throw std::runtime_error("ShowWriter can't finish file");
+}
+
+/**
+ * @class cs::ShowReader
+ */
+ShowReader::ShowReader(const std::string &path)
+		: mFile(path) {
+	if (mFile.size() < sizeof(FileHeader)) throw std::runtime_error("ShowReader file is too small " + path);
+
+	FileHeader				h;
+	std::memcpy(&h, mFile.data(), sizeof(h));
+	if (std::memcmp(h.mMagic, MAGIC, sizeof(MAGIC)) != 0) throw std::runtime_error("ShowReader not a show file " + path);
+	if (h.mVersion != VERSION) throw std::runtime_error("ShowReader unsupported version " + path);
+	if (h.mParticleCount < 1 || h.mFrameCount < 1) throw std::runtime_error("ShowReader empty show " + path);
+	if (h.mFrameSize != frame_size(h.mParticleCount)) throw std::runtime_error("ShowReader bad frame size " + path);
+	if (mFile.size() < sizeof(FileHeader) + static_cast<size_t>(h.mFrameCount) * h.mFrameSize) {
+		throw std::runtime_error("ShowReader file is truncated " + path);
+	}
+
+	mCount = h.mParticleCount;
+	mFrames = h.mFrameCount;
+	mFrameSize = h.mFrameSize;
+	mMin = glm::vec3(h.mMin[0], h.mMin[1], h.mMin[2]);
+	mSize = glm::vec3(h.mSize[0], h.mSize[1], h.mSize[2]);
+}
+
+void ShowReader::read(const size_t frame, ParticleList &out) const {
+	if (frame >= mFrames) throw std::runtime_error("ShowReader frame out of range");
+
+	const uint8_t*			src = mFile.data() + sizeof(FileHeader) + frame * mFrameSize;
+	FrameHeader				fh;
+	std::memcpy(&fh, src, sizeof(fh));
+	const ParticleRecord*	rec = reinterpret_cast<const ParticleRecord*>(src + sizeof(FrameHeader));
+	const bool				key = (fh.mFlags & FRAME_KEY) != 0;
+	if (!key && out.size() != mCount) throw std::runtime_error("ShowReader can't start on a delta frame");
+
+	// Particles that didn't exist yet start at rest.
+	const size_t			synced = (out.size() < mCount ? out.size() : mCount);
+	out.resize(mCount);
+
+	const glm::vec3			scale(fh.mScale[0], fh.mScale[1], fh.mScale[2]);
+	for (size_t k=0; k<mCount; ++k) {
+		Particle&			p(out[k]);
+		const ParticleRecord& r(rec[k]);
+		if (key) {
+			p.mCurve.mP3 = from_unorm16(r.mEnd, mMin, mSize);
+		} else {
+			for (int j=0; j<3; ++j) p.mCurve.mP3[j] += from_delta(r.mEnd[j], scale[j]);
+		}
+		p.mCurve.mP1 = from_unorm16(r.mP1, mMin, mSize);
+		p.mCurve.mP2 = from_unorm16(r.mP2, mMin, mSize);
+		if (k < synced) {
+			p.mCurve.mP0 = p.mPosition;
+			p.mStartAlpha = p.mEndAlpha;
+		} else {
+			p.mCurve.mP0 = p.mPosition = p.mCurve.mP3;
+			p.mAlpha = p.mStartAlpha = static_cast<float>(r.mEndAlpha) / 255.0f;
+		}
+		p.mEndAlpha = static_cast<float>(r.mEndAlpha) / 255.0f;
+		p.mHasAccents = (r.mFlags & PARTICLE_ACCENTS) != 0;
+	}
+
+	out.mTransitionDuration = fh.mTransitionDuration;
+	out.mHoldDuration = fh.mHoldDuration;
+	out.mMaxCurveLength = fh.mMaxCurveLength;
+	out.mAverageCurveLength = fh.mAverageCurveLength;
+}
+
+} // namespace cs
@@ -0,0 +1,82 @@
+#ifndef CS_SHOWFILE_H_
+#define CS_SHOWFILE_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "kt/io/mapped_file.h"
+#include "kt/math/geometry.h"
+#include "particle_list.h"
+
+namespace cs {
+
+/**
+ * SHOW FILES
+ * A show is a baked sequence of frames, played back instead of generated.
+ * The file is a versioned header followed by fixed-size frames. A frame only
+ * stores what can't be inferred from the frame before it: each curve starts
+ * where the last one ended, so only the endpoint, control points and end
+ * alpha are stored. Endpoints are quantized deltas against the previous
+ * endpoints; control points are quantized to a box around the world bounds.
+ * The first frame is a key frame, with absolute endpoints.
+ *
+ * Shows are baked for one set of world bounds, so play them back at the
+ * resolution they were baked at. Files are little-endian.
+ */
+
+/**
+ * @class cs::ShowWriter
+ * @brief Write a show file. Throws on any error.
+ */
+class ShowWriter {
+public:
+	ShowWriter() = delete;
+	ShowWriter(const ShowWriter&) = delete;
+	ShowWriter(const std::string &path, const kt::math::Cube &bounds, const size_t count);
+	~ShowWriter();
+
+	// Append a frame, which must be the same size as the show.
+	void							write(const ParticleList&);
+	// Finish the header. Called automatically on destruction.
+	void							close();
+
+private:
+	std::ofstream					mFile;
+	const size_t					mCount;
+	size_t							mFrames = 0;
+	glm::vec3						mMin, mSize;
+	// The endpoints as the reader will reconstruct them, so quantization
+	// error doesn't accumulate across frames.
+	std::vector<glm::vec3>			mEnd;
+	std::vector<uint8_t>			mBuffer;
+};
+
+/**
+ * @class cs::ShowReader
+ * @brief Play back a show file from a memory map. Throws on any error.
+ */
+class ShowReader {
+public:
+	ShowReader() = delete;
+	ShowReader(const ShowReader&) = delete;
+	explicit ShowReader(const std::string &path);
+
+	size_t							getParticleCount() const { return mCount; }
+	size_t							getFrameCount() const { return mFrames; }
+
+	// Decode a frame in place. Unless it's a key frame, out must hold the
+	// previous frame. The particles' current positions become the start of
+	// the new curves.
+	void							read(const size_t frame, ParticleList &out) const;
+
+private:
+	kt::io::MappedFile				mFile;
+	size_t							mCount = 0,
+									mFrames = 0,
+									mFrameSize = 0;
+	glm::vec3						mMin, mSize;
+};
+
+} // namespace cs
+
+#endif
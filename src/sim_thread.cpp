@@ -0,0 +1,125 @@
+#include "sim_thread.h"
+
+#include "kt/async/thread_attributes.h"
+#include "feeder.h"
+#include "settings.h"
+
+namespace cs {
+
+namespace {
+// If the sim falls further behind than this many ticks, it skips them
+// rather than trying to catch up.
+const int			MAX_LAG_TICKS = 4;
+}
+
+/**
+ * @class cs::SimThread
+ */
+SimThread::SimThread(const cs::Settings &settings)
+		: mSettings(settings)
+		, mTickSeconds(1.0 / (settings.mSimRate > 1.0 ? settings.mSimRate : 1.0))
+		, mSim(settings) {
+	mThread = std::thread([this](){loop();});
+}
+
+SimThread::~SimThread() {
+	try {
+		{
+			std::lock_guard<std::mutex>		lock(mMutex);
+			mStop = true;
+		}
+		mStopCondition.notify_all();
+		mThread.join();
+	} catch (std::exception const&) {
+	}
+}
+
+void SimThread::setWorldBounds(const kt::math::Cube &b) {
+	std::lock_guard<std::mutex>		lock(mMutex);
+	mWorldBounds = b;
+}
+
+bool SimThread::wantsFrame() const {
+	std::lock_guard<std::mutex>		lock(mMutex);
+	return !mHasMail;
+}
+
+void SimThread::post(const ParticleList &frame) {
+	std::lock_guard<std::mutex>		lock(mMutex);
+	mMailbox.assign(frame.begin(), frame.end());
+	mMailbox.setParametersFrom(frame);
+	mHasMail = true;
+}
+
+void SimThread::loop() {
+	kt::async::ThreadAttributes		attributes(mSettings.mSimThread);
+	attributes.mName = "sim";
+	attributes.apply();
+
+	typedef std::chrono::steady_clock	clock;
+	const auto						tick_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(mTickSeconds));
+	clock::time_point				next = clock::now();
+	uint64_t						tick = 0;
+
+	while (true) {
+		// Sim time is only ever the tick, so motion is the same at any frame rate.
+		const double				now = static_cast<double>(tick) * mTickSeconds;
+		{
+			std::lock_guard<std::mutex>	lock(mMutex);
+			if (mStop) return;
+			mSim.setWorldBounds(mWorldBounds);
+			if (mHasMail && mSim.wantsFrame(now)) {
+				mInbox.swap(mMailbox);
+				mHasMail = false;
+			}
+		}
+		if (!mInbox.empty()) {
+			Feeder::syncFrame(mSim.getParticles(), mInbox);
+			mSim.getParticles().swap(mInbox);
+			mInbox.clear();
+			mSim.startTransition(now);
+		}
+
+		mSim.updateAccents();
+		mSim.updateStage(now);
+		mSim.updateParticles();
+		mSim.spawnAccents();
+		publish(tick, clock::now());
+		++tick;
+
+		// Wait for the next tick, or stop.
+		next += tick_duration;
+		const clock::time_point		current = clock::now();
+		if (current > next + tick_duration * MAX_LAG_TICKS) next = current;
+		std::unique_lock<std::mutex>	lock(mMutex);
+		mStopCondition.wait_until(lock, next, [this](){return mStop;});
+	}
+}
+
+void SimThread::publish(const uint64_t tick, const std::chrono::steady_clock::time_point &time) {
+	Snapshot&						s(mSnapshots.back());
+	s.mTick = tick;
+	s.mTime = time;
+
+	const ParticleList&				particles(mSim.getParticles());
+	s.mParticles.resize(particles.size());
+	for (size_t k=0; k<particles.size(); ++k) {
+		s.mParticles[k] = glm::vec4(particles[k].mPosition, particles[k].mAlpha);
+	}
+	const ParticleList&				accents(mSim.getAccents());
+	s.mAccents.resize(accents.size());
+	s.mAccentIds.resize(accents.size());
+	for (size_t k=0; k<accents.size(); ++k) {
+		s.mAccents[k] = glm::vec4(accents[k].mPosition, accents[k].mAlpha);
+		s.mAccentIds[k] = accents[k].mId;
+	}
+	s.mColors.clear();
+	s.mAccentColors.clear();
+	if (mSettings.mParticleColors) {
+		for (const auto& p : particles) s.mColors.push_back(p.mColor);
+		for (const auto& p : accents) s.mAccentColors.push_back(p.mColor);
+	}
+	mSnapshots.publish();
+}
+
+} // namespace cs
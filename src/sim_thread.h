@@ -0,0 +1,99 @@
+#ifndef CS_SIMTHREAD_H_
+#define CS_SIMTHREAD_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "kt/async/triple_buffer.h"
+#include "particle_sim.h"
+
+namespace cs {
+class Settings;
+
+/**
+ * @class cs::SimThread
+ * @brief Run the particle sim on its own thread, at a fixed tick.
+ * @description Every tick is published as a snapshot of what to draw, so
+ * the render thread never waits on the sim and the sim's cost isn't part of
+ * the frame time. Frames arrive through a one-slot mailbox: the main thread
+ * posts the next frame whenever the slot is empty, and the sim takes it when
+ * its hold is over. Motion depends only on the tick, not the display.
+ */
+class SimThread {
+public:
+	SimThread() = delete;
+	SimThread(const SimThread&) = delete;
+	explicit SimThread(const cs::Settings&);
+	~SimThread();
+
+	// Everything at one tick, packed for drawing.
+	class Snapshot {
+	public:
+		Snapshot() { }
+
+		void					swap(Snapshot &o) {
+			std::swap(mTick, o.mTick);
+			std::swap(mTime, o.mTime);
+			mParticles.swap(o.mParticles);
+			mAccents.swap(o.mAccents);
+			mColors.swap(o.mColors);
+			mAccentColors.swap(o.mAccentColors);
+			mAccentIds.swap(o.mAccentIds);
+		}
+
+		uint64_t				mTick = 0;
+		std::chrono::steady_clock::time_point
+								mTime;
+		// Position and alpha.
+		std::vector<glm::vec4>	mParticles,
+								mAccents;
+		// Packed colors, if the settings draw them.
+		std::vector<uint32_t>	mColors,
+								mAccentColors;
+		// Which accent each is, since they die out of order.
+		std::vector<uint32_t>	mAccentIds;
+	};
+
+	// Main thread.
+	void						setWorldBounds(const kt::math::Cube&);
+	// Answer true if the mailbox is empty.
+	bool						wantsFrame() const;
+	// Copy the frame into the mailbox.
+	void						post(const ParticleList&);
+	kt::async::TripleBuffer<Snapshot>&
+								getSnapshots() { return mSnapshots; }
+	double						getTickSeconds() const { return mTickSeconds; }
+
+private:
+	void						loop();
+	void						publish(const uint64_t tick, const std::chrono::steady_clock::time_point&);
+
+	const cs::Settings&			mSettings;
+	const double				mTickSeconds;
+
+	// Shared.
+	mutable std::mutex			mMutex;
+	std::condition_variable		mStopCondition;
+	bool						mStop = false;
+	ParticleList				mMailbox;
+	bool						mHasMail = false;
+	kt::math::Cube				mWorldBounds;
+
+	// Sim thread only.
+	ParticleSim					mSim;
+	ParticleList				mInbox;
+
+	kt::async::TripleBuffer<Snapshot>
+								mSnapshots;
+	// Last, so everything is ready before it starts.
+	std::thread					mThread;
+};
+
+} // namespace cs
+
+#endif
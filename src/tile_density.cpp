@@ -0,0 +1,113 @@
+#include "tile_density.h"
+
+#include <cmath>
+#include <thread>
+#include "kt/async/thread_pool.h"
+
+namespace cs {
+
+namespace {
+const float			UNORM16 = 65535.0f,
+					UNORM8 = 255.0f;
+// Tiles per chunk when totalling the histograms.
+const size_t		TOTAL_GRAIN = 1024;
+
+// Answer a value in [0, 1) that depends only on the particle.
+inline float		unit_hash(const uint32_t id) {
+	uint32_t		h = id * 0x9e3779b1u;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return static_cast<float>(h >> 8) * (1.0f / 16777216.0f);
+}
+}
+
+/**
+ * @class cs::TileDensity
+ */
+TileDensity::TileDensity()
+		: mKeep(GRID * GRID, 1.0f)
+		, mCoverage(GRID * GRID, 0.0f) {
+}
+
+void TileDensity::begin(const InstancePacker &packer, const float particle_size, const float budget) {
+	const kt::math::Cube&	b(packer.getBounds());
+	const float				far_x = b.mFarUR.x - b.mFarLL.x,
+							far_y = b.mFarUR.y - b.mFarLL.y;
+	mSpanX = far_x;
+	mSpanXSlope = (b.mNearUR.x - b.mNearLL.x) - far_x;
+	mSpanY = far_y;
+	mSpanYSlope = (b.mNearUR.y - b.mNearLL.y) - far_y;
+	mArea = particle_size * particle_size * static_cast<float>(GRID * GRID);
+
+	for (size_t k=0; k<mKeep.size(); ++k) {
+		const float			c = mCoverage[k];
+		mKeep[k] = (c > budget ? budget / c : 1.0f);
+	}
+	// One for each thread that works on a loop, including the caller.
+	const size_t			threads = kt::async::ThreadPool::shared().getConcurrency();
+	while (mHistograms.size() < threads) mHistograms.push_back(std::unique_ptr<Histogram>(new Histogram()));
+}
+
+size_t TileDensity::thin(Instance *instances, uint32_t *colors, const uint32_t *ids, const size_t count) {
+	Histogram&				hist(claim());
+	hist.mUsed = true;
+	float*					coverage = hist.mCoverage.data();
+	const float*			keep = mKeep.data();
+	const uint32_t			shift = 16 - GRID_BITS;
+
+	size_t					n = 0;
+	for (size_t k=0; k<count; ++k) {
+		const Instance		i(instances[k]);
+		const uint32_t		tile = (static_cast<uint32_t>(i.mY) >> shift) * GRID + (static_cast<uint32_t>(i.mX) >> shift);
+		const float			uz = static_cast<float>(i.mZ) / UNORM16;
+		const float			tile_area = std::fabs((mSpanX + mSpanXSlope * uz) * (mSpanY + mSpanYSlope * uz));
+		if (tile_area > 0.0f) coverage[tile] += mArea * (static_cast<float>(i.mAlpha) / UNORM8) / tile_area;
+
+		if (keep[tile] < 1.0f && unit_hash(ids[k]) >= keep[tile]) continue;
+		instances[n] = i;
+		if (colors) colors[n] = colors[k];
+		++n;
+	}
+	hist.mBusy.store(false, std::memory_order_release);
+	return n;
+}
+
+void TileDensity::end() {
+	std::vector<float*>		used;
+	for (auto& h : mHistograms) {
+		if (h->mUsed) used.push_back(h->mCoverage.data());
+		h->mUsed = false;
+	}
+	float*					total = mCoverage.data();
+	const std::vector<float*>&	hists(used);
+	kt::async::parallel_for(0, mCoverage.size(), TOTAL_GRAIN, [total, &hists](const size_t b, const size_t e) {
+		for (size_t t=b; t<e; ++t) total[t] = 0.0f;
+		for (float* h : hists) {
+			for (size_t t=b; t<e; ++t) {
+				total[t] += h[t];
+				h[t] = 0.0f;
+			}
+		}
+	});
+}
+
+TileDensity::Histogram& TileDensity::claim() {
+	while (true) {
+		for (auto& h : mHistograms) {
+			bool			free = false;
+			if (h->mBusy.compare_exchange_strong(free, true, std::memory_order_acquire)) return *h;
+		}
+		std::this_thread::yield();
+	}
+}
+
+/**
+ * @class cs::TileDensity::Histogram
+ */
+TileDensity::Histogram::Histogram()
+		: mBusy(false)
+		, mCoverage(GRID * GRID, 0.0f) {
+}
+
+} // namespace cs
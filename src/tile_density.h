@@ -0,0 +1,76 @@
+#ifndef CS_TILEDENSITY_H_
+#define CS_TILEDENSITY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "instance_packer.h"
+
+namespace cs {
+
+/**
+ * @class cs::TileDensity
+ * @brief Thin out instances where the screen is already saturated.
+ * @description The saturate pass clamps the particle alpha, so past a
+ * certain density more particles cost fill rate but change nothing. I keep
+ * a coarse histogram of coverage over a grid of screen tiles: each instance
+ * adds its alpha times the fraction of a tile it covers at its depth. In a
+ * tile whose coverage went over the budget last frame, only budget/coverage
+ * of the instances are kept, picked by a hash of each particle's id, so a
+ * particle stays kept or dropped as it moves, instead of flickering, and
+ * the tile stays saturated.
+ *
+ * A frame is begin(), then thin() on any number of chunks, concurrently,
+ * then end(). Each thin() adds to whichever histogram no other chunk is
+ * using, so there are only as many as chunks run at once, and end() clears
+ * them as it totals them.
+ */
+class TileDensity {
+public:
+	TileDensity();
+
+	// Start a frame, quantized by packer. Particle size is in world units.
+	// Budget is the coverage a tile needs to count as saturated.
+	void				begin(const InstancePacker&, const float particle_size, const float budget);
+	// Thin count instances in place, and their colors if there are any.
+	// ids are the instances' particle ids, from InstancePacker::pack().
+	// Answer how many are left.
+	size_t				thin(Instance*, uint32_t *colors, const uint32_t *ids, const size_t count);
+	// Total the chunks' coverage, for next frame.
+	void				end();
+
+private:
+	// Tiles across and down the packing bounds.
+	static const uint32_t	GRID_BITS = 7,
+						GRID = 1 << GRID_BITS;
+
+	// Frame constants. Tile coverage at unit depth uz is scaled by
+	// 1 / ((mSpanX + mSpanXSlope * uz) * (mSpanY + mSpanYSlope * uz)).
+	float				mArea = 0.0f,
+						mSpanX = 1.0f,
+						mSpanXSlope = 0.0f,
+						mSpanY = 1.0f,
+						mSpanYSlope = 0.0f;
+	// The fraction of each tile to keep, from last frame's coverage.
+	std::vector<float>	mKeep;
+	// This frame's coverage, spread over as many histograms as chunks ran
+	// at once, and the total.
+	class Histogram {
+	public:
+		Histogram();
+
+		std::atomic<bool>	mBusy;
+		bool				mUsed = false;
+		std::vector<float>	mCoverage;
+	};
+	std::vector<std::unique_ptr<Histogram>>	mHistograms;
+	std::vector<float>	mCoverage;
+
+	// Answer a histogram no other chunk is using.
+	Histogram&			claim();
+};
+
+} // namespace cs
+
+#endif